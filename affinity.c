@@ -0,0 +1,105 @@
+/*
+ * affinity.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "affinity.h"
+#include "logger.h"
+
+static int cpus[AFFINITY_MAX_CPUS];	//!< usable CPUs in ascending order
+static int ncpus    = 0;
+static int nworkers = 0;
+
+int affinity_init(int workers)
+{
+	cpu_set_t set;
+	int cpu = 0;
+
+	/* the mask a process starts with already leaves out what cpuset and isolcpus take away */
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+		LOGGER_ERR("sched_getaffinity failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE && ncpus < AFFINITY_MAX_CPUS; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			cpus[ncpus++] = cpu;
+
+	if (!ncpus)
+		return -1;
+
+	nworkers = workers;
+	if (nworkers > ncpus)
+		LOGGER_ERR("%d workers share %d cpus, connections are not steered\n", nworkers, ncpus);
+
+	return 0;
+}
+
+int affinity_pin(int worker)
+{
+	cpu_set_t set;
+	int rc = 0;
+
+	if (!ncpus)
+		return -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpus[worker % ncpus], &set);
+
+	rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc) {
+		LOGGER_ERR("worker {%d} failed to pin to cpu {%d}: %s\n", worker, cpus[worker % ncpus], strerror(rc));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * A = cpu
+ * A == cpus[n] ? return n, one compare per worker
+ * return A % workers
+ */
+int affinity_steer(int fd)
+{
+	struct sock_filter code[2 * AFFINITY_MAX_CPUS + 3];
+	struct sock_fprog  prog;
+	int n = 0;
+	int i = 0;
+
+	if (!nworkers || nworkers > ncpus)
+		return 0;
+
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+	for (i = 0; i < nworkers; i++) {
+		code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (unsigned)cpus[i], 0, 1);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, (unsigned)i);
+	}
+
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned)nworkers);
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+	prog.len    = (unsigned short)n;
+	prog.filter = code;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		LOGGER_ERR("failed to attach reuseport program: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
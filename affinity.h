@@ -0,0 +1,34 @@
+/*
+ * affinity.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+#define AFFINITY_MAX_CPUS 256
+
+/*
+ * Cache affine placement: worker n runs pinned to the n-th CPU the
+ * process may use, so the cpuset of its cgroup, isolcpus and taskset
+ * are respected. A classic BPF program on the SO_REUSEPORT group of
+ * every port hands a new connection to the listener of the worker on
+ * the CPU that took its SYN from the RX queue: softirq and proxy share
+ * the caches. A CPU without a worker is spread by modulo.
+ */
+
+/* process wide, before the workers start; -1 if no CPU is usable */
+int affinity_init(int workers);
+
+/* from the worker thread */
+int affinity_pin(int worker);
+
+/*
+ * fd is any listener of a port, the group must have the listeners of
+ * workers 0..n-1 in that order: the kernel indexes them by listen()
+ */
+int affinity_steer(int fd);
+
+#endif /* AFFINITY_H_ */
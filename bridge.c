@@ -17,6 +17,40 @@
 #include "logger.h"
 #include "sp.h"
 #include "socket_utils.h"
+#include "stats.h"
+#include "budget.h"
+#include "io_loop.h"
+#include "sockmap.h"
+#include "ratelimit.h"
+
+int bridge_budget_check(socket_ctx_t *sock)
+{
+	size_t queued = (sock->queue) ? sock->queue->size : 0;
+
+	if (!budget_over_share(queued)) {
+		bridge_budget_resume(sock);
+		return 0;
+	}
+
+	if (!sock->budget_paused) {
+		sock->budget_paused = 1;
+		sock->budget_since  = io_loop_now();
+		STATS_INC(budget_paused);
+		STATS_INC(budget_pauses);
+	}
+
+	return 1;
+}
+
+void bridge_budget_resume(socket_ctx_t *sock)
+{
+	if (!sock->budget_paused)
+		return;
+
+	sock->budget_paused = 0;
+	STATS_DEC(budget_paused);
+	STATS_ADD(budget_pause_ms, io_loop_now() - sock->budget_since);
+}
 
 static void __bridge_destroy(void *ptr)
 {
@@ -27,11 +61,34 @@ static void __bridge_destroy(void *ptr)
 	if (!obj)
 		return;
 
+	STATS_INC(closed);
+	STATS_SUB(resident, sizeof(bridge_t) + OFFSET);
+
+	if (obj->abort) {
+		STATS_INC(aborted);
+
+		if (obj->cli.fd >= 0)
+			socket_abort(obj->cli.fd);
+		if (obj->srv.fd >= 0)
+			socket_abort(obj->srv.fd);
+	}
+
+	ratelimit_release(obj->cli.sa.sin_addr.s_addr);
+
 	if (obj->cli.fd >= 0)
-		close(obj->cli.fd);
+		io_close_sock(obj->cli.fd);
 
 	if (obj->srv.fd >= 0)
-		close(obj->srv.fd);
+		io_close_sock(obj->srv.fd);
+
+	pipe_pool_put(&obj->cli.pipe);
+	pipe_pool_put(&obj->srv.pipe);
+
+	bridge_budget_resume(&obj->cli);
+	bridge_budget_resume(&obj->srv);
+
+	zc_release(&obj->cli.zc, obj->cli.queue);
+	zc_release(&obj->srv.zc, obj->srv.queue);
 
 	if (obj->cli.queue)
 		sp_free(obj->cli.queue);
@@ -40,7 +97,7 @@ static void __bridge_destroy(void *ptr)
 		sp_free(obj->srv.queue);
 }
 
-bridge_t *bridge_create(int cli_fd)
+bridge_t *bridge_create(int cli_fd, size_t ring_size, unsigned short listen_port)
 {
 	bridge_t *rc = NULL;
 
@@ -70,25 +127,31 @@ bridge_t *bridge_create(int cli_fd)
 		if (!rc)
 			break;
 
+		STATS_ADD(resident, sizeof(bridge_t) + OFFSET);
+
 		rc->cli.sa = cli_addr;
 		rc->srv.sa = srv_addr;
 
+		rc->cli.pipe.rfd = rc->cli.pipe.wfd = -1;
+		rc->srv.pipe.rfd = rc->srv.pipe.wfd = -1;
+
 		rc->cli.fd = cli_fd;
-		rc->srv.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-		if (rc->srv.fd < 0)
-			break;
+		rc->srv.fd = -1;
 
-		if (configure_socket(rc->srv.fd) < 0)
-			break;
+		rc->listen_port = listen_port;
 
-		if (bind(rc->srv.fd,(struct sockaddr*)&cli_addr,sizeof(cli_addr)) < 0)
-			break;
+		rc->profile = profile_lookup(listen_port, ntohs(srv_addr.sin_port));
+		if (profile_apply(rc->profile, rc->cli.fd) < 0)
+			LOGGER_DBG( "bridge {%p} profile {%s} is not fully applied to cli\n", rc, rc->profile->name);
 
-		rc->cli.queue = queue_create(QUEUE_SIZE);
-		rc->srv.queue = queue_create(QUEUE_SIZE);
+		/* a profile sizes the rings of its bridges, -1 keeps the default */
+		if (rc->profile && rc->profile->ring >= 0)
+			ring_size = (size_t)rc->profile->ring;
 
-		if (!rc->cli.queue || !rc->srv.queue)
-			break;
+		/* queues come with the first read, see bridge_queue() */
+		rc->ring_size      = ring_size;
+		rc->cli.queue_size = (ring_size) ? ring_size : QUEUE_SIZE;
+		rc->srv.queue_size = (ring_size) ? ring_size : QUEUE_SIZE;
 
 		bridge_set_state(rc, BRIDGE_NEW);
 
@@ -108,7 +171,38 @@ bridge_t *bridge_create(int cli_fd)
 	return NULL;
 }
 
-int bridge_connect(bridge_t *this)
+int bridge_upstream(bridge_t *this)
+{
+	int rc = -1;
+
+	do {
+		if (!this || this->srv.fd >= 0)
+			break;
+
+		this->srv.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (this->srv.fd < 0)
+			break;
+
+		if (configure_socket(this->srv.fd) < 0)
+			break;
+
+		/* buffer sizes must be in place before connect() for the window scale */
+		if (profile_apply(this->profile, this->srv.fd) < 0)
+			LOGGER_DBG( "bridge {%p} profile {%s} is not fully applied to srv\n", this, this->profile->name);
+
+		if (bind(this->srv.fd, (struct sockaddr*)&this->cli.sa, sizeof(this->cli.sa)) < 0)
+			break;
+
+		rc = 0;
+	} while(0);
+
+	if (rc < 0)
+		LOGGER_DBG( "failed to create upstream socket for bridge {%p}\n", this);
+
+	return rc;
+}
+
+int bridge_connect(bridge_t *this, int fastopen)
 {
 	int rc = -1;
 
@@ -116,10 +210,21 @@ int bridge_connect(bridge_t *this)
 		if (!this)
 			break;
 
+		if (fastopen && socket_fastopen(this->srv.fd) < 0) {
+			LOGGER_DBG( "bridge {%p} TCP_FASTOPEN_CONNECT failed: %s\n", this, strerror(errno));
+			fastopen = 0;
+		}
+
 		int n = connect(this->srv.fd, (struct sockaddr*)&this->srv.sa, sizeof(this->srv.sa));
 		if (n < 0 && EINPROGRESS != errno)
 			break;
 
+		/* a cookie is cached: no SYN yet, srv is writable right away */
+		if (fastopen && !n)
+			this->fastopen = 1;
+		else if (fastopen)
+			STATS_INC(fastopen_fallbacks);
+
 		this->state = BRIDGE_CONNECTING;
 
 		rc = 0;
@@ -131,6 +236,33 @@ int bridge_connect(bridge_t *this)
 	return rc;
 }
 
+int bridge_fastopen_check(bridge_t *this)
+{
+	int syn_data = socket_syn_data(this->srv.fd);
+
+	if (syn_data < 0)
+		return 0;
+
+	/* a SYN sent for a silent client is acked with the cookie too, but carried nothing */
+	if (syn_data && 1 == this->fastopen) {
+		STATS_INC(fastopen_sent);
+	} else {
+		LOGGER_DBG( "bridge {%p} no data in the SYN\n", this);
+		STATS_INC(fastopen_fallbacks);
+	}
+
+	this->fastopen = 0;
+
+	return 1;
+}
+
+/* a send of nothing on a deferred socket is what makes the kernel send its SYN */
+void bridge_fastopen_syn(bridge_t *this)
+{
+	if (send(this->srv.fd, NULL, 0, MSG_NOSIGNAL) < 0 && EINPROGRESS == errno)
+		this->fastopen = 2;
+}
+
 void bridge_set_state(bridge_t *this, bridge_state_t state)
 {
 	switch (state) {
@@ -154,3 +286,336 @@ void bridge_set_state(bridge_t *this, bridge_state_t state)
 			break;
 	}
 }
+
+int bridge_enable_splice(bridge_t *this)
+{
+	int rc = -1;
+
+	do {
+		if (!this)
+			break;
+
+		if (pipe_pool_get(&this->cli.pipe) < 0)
+			break;
+
+		if (pipe_pool_get(&this->srv.pipe) < 0)
+			break;
+
+		this->splice = 1;
+
+		rc = 0;
+	} while(0);
+
+	if (rc < 0 && this) {
+		pipe_pool_put(&this->cli.pipe);
+		pipe_pool_put(&this->srv.pipe);
+	}
+
+	return rc;
+}
+
+/* size the queue of sock, fed by reads from peer, after the BDP of sock */
+static void __socket_autosize(socket_ctx_t *sock, socket_ctx_t *peer, size_t floor, size_t ceil, int sockbuf)
+{
+	size_t size = socket_bdp(sock->fd);
+	int    val  = 0;
+
+	if (!size)
+		return;
+
+	if (size < floor) size = floor;
+	if (size > ceil)  size = ceil;
+
+	stats_qsize(size);
+
+	if (size == sock->queue_size)
+		return;
+
+	LOGGER_DBG( "fd {%d} queue size {%zu} -> {%zu}\n", sock->fd, sock->queue_size, size);
+
+	sock->queue_size = size;
+	if (sock->queue)
+		sock->queue->max_size = size;
+
+	/* fixed buffers switch kernel autotuning off, so it's opt-in */
+	if (sockbuf) {
+		val = (int)size;
+		setsockopt(sock->fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val));
+		setsockopt(peer->fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+	}
+}
+
+void bridge_autosize(bridge_t *this, size_t floor, size_t ceil, int sockbuf)
+{
+	/* a ring has a fixed capacity and a pipe is sized by the pool */
+	if (!this || this->splice || this->ring_size)
+		return;
+
+	__socket_autosize(&this->cli, &this->srv, floor, ceil, sockbuf);
+	__socket_autosize(&this->srv, &this->cli, floor, ceil, sockbuf);
+}
+
+send_queue_t *bridge_queue(bridge_t *this, socket_ctx_t *sock)
+{
+	if (sock->queue)
+		return sock->queue;
+
+	if (this->ring_size)
+		sock->queue = queue_create_ring(sock->queue_size);
+	else
+		sock->queue = queue_create(sock->queue_size);
+
+	return sock->queue;
+}
+
+static void __queue_release(socket_ctx_t *sock)
+{
+	if (!sock->queue || !queue_is_empty(sock->queue))
+		return;
+
+	sock->queue = sp_free(sock->queue);
+}
+
+void bridge_queue_trim(socket_ctx_t *sock)
+{
+	/* a ring is allocated once and kept until its direction is done, no malloc per drain */
+	if (sock->queue && sock->queue->ring)
+		return;
+
+	__queue_release(sock);
+}
+
+/*
+ * Only an idle bridge moves: nothing queued in userspace and nothing
+ * unread, or redirected data could overtake data still on its way
+ * through userspace. srv goes in first, until cli follows the data
+ * received on srv finds no peer and stays with srv for userspace.
+ */
+int bridge_sockmap(bridge_t *this)
+{
+	if (this->sockmap)
+		return this->sockmap;
+
+	/* the sockhash takes established sockets only */
+	if (this->fastopen)
+		return 0;
+
+	if (!socket_out_is_empty(&this->cli) || !socket_out_is_empty(&this->srv))
+		return 0;
+
+	if (sockmap_unread(this->cli.fd) || sockmap_unread(this->srv.fd))
+		return 0;
+
+	do {
+		if (sockmap_add(this->srv.fd, this->cli.fd) < 0)
+			break;
+
+		if (sockmap_add(this->cli.fd, this->srv.fd) < 0) {
+			sockmap_del(this->srv.fd, this->cli.fd);
+			break;
+		}
+
+		LOGGER_DBG( "bridge {%p} is forwarded by the kernel\n", this);
+		STATS_INC(sockmap_offloads);
+		this->sockmap = 1;
+
+		return 1;
+	} while(0);
+
+	STATS_INC(sockmap_fails);
+	this->sockmap = -1;
+
+	return -1;
+}
+
+int bridge_sockmap_drain(socket_ctx_t *sock)
+{
+	if (!sock->shut_wait)
+		return 0;
+
+	if (sockmap_unsent(sock->fd) > 0) {
+		sock->drain_idle = 0;
+		return 1;
+	}
+
+	if (++sock->drain_idle < SOCKMAP_DRAIN_SAMPLES)
+		return 1;
+
+	sock->shut_wait = 0;
+	bridge_shutdown(sock);
+
+	return 0;
+}
+
+/* the kernel moves the data without waking us, last_io alone says nothing */
+uint64_t bridge_sockmap_idle(bridge_t *this, uint64_t idle)
+{
+	uint64_t cli = socket_idle(this->cli.fd);
+	uint64_t srv = socket_idle(this->srv.fd);
+
+	if (cli < idle) idle = cli;
+	if (srv < idle) idle = srv;
+
+	return idle;
+}
+
+static size_t __socket_pending(socket_ctx_t *sock)
+{
+	if (sock->pipe.rfd >= 0)
+		return sock->pipe.len;
+
+	return (sock->queue) ? sock->queue->size : 0;
+}
+
+/* what waits for sock, a pipe is read empty: the bridge is going away */
+static int __socket_copy(socket_ctx_t *sock, char *buf, size_t len)
+{
+	size_t done = 0;
+
+	if (sock->pipe.rfd < 0)
+		return (queue_copy(sock->queue, buf, len) == len) ? 0 : -1;
+
+	while (done < len) {
+		ssize_t n = read(sock->pipe.rfd, buf + done, len - done);
+		if (n <= 0)
+			return -1;
+
+		done += n;
+		sock->pipe.len -= n;
+	}
+
+	return 0;
+}
+
+int bridge_export(bridge_t *this, upgrade_bridge_t *rec, char **data)
+{
+	size_t cli = __socket_pending(&this->cli);
+	size_t srv = __socket_pending(&this->srv);
+
+	/* the sockhash is ours alone, the new process offloads the bridge again once it is idle */
+	if (this->sockmap > 0) {
+		sockmap_del(this->srv.fd, this->cli.fd);
+		sockmap_del(this->cli.fd, this->srv.fd);
+	}
+
+	memset(rec, 0, sizeof(*rec));
+	rec->state         = this->state;
+	rec->fastopen      = this->fastopen;
+	rec->listen_port   = this->listen_port;
+	rec->cli_eof       = !!this->cli.eof;
+	rec->cli_shut      = !!this->cli.shut;
+	rec->srv_eof       = !!this->srv.eof;
+	rec->srv_shut      = !!this->srv.shut;
+	rec->created       = this->created;
+	rec->connected     = this->connected;
+	rec->stopping      = this->stopping;
+	rec->connect_start = this->connect_start;
+	rec->last_io       = this->last_io;
+	rec->cli_pending   = (uint32_t)cli;
+	rec->srv_pending   = (uint32_t)srv;
+
+	*data = NULL;
+	if (!cli && !srv)
+		return 0;
+
+	*data = sp_malloc(cli + srv);
+	if (!*data)
+		return -1;
+
+	if (__socket_copy(&this->cli, *data, cli) < 0 || __socket_copy(&this->srv, *data + cli, srv) < 0) {
+		*data = sp_free(*data);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the queue takes all of it at once, a ring grows to fit */
+static int __socket_restore(bridge_t *this, socket_ctx_t *sock, char *buf, size_t len)
+{
+	send_queue_t *queue = NULL;
+	size_t off = 0;
+	size_t n   = 0;
+
+	if (!len)
+		return 0;
+
+	if (this->ring_size && sock->queue_size < len)
+		sock->queue_size = len;
+
+	queue = bridge_queue(this, sock);
+	if (!queue)
+		return -1;
+
+	for (off = 0; off < len; off += n) {
+		n = (len - off > QUEUE_SIZE) ? QUEUE_SIZE : len - off;
+		if (queue_enqueue(queue, buf + off, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+bridge_t *bridge_import(upgrade_import_t *imp, size_t ring_size)
+{
+	upgrade_bridge_t *rec = &imp->rec;
+	bridge_t         *rc  = bridge_create(imp->cli_fd, ring_size, rec->listen_port);
+
+	if (!rc)
+		return NULL;
+
+	rc->srv.fd  = imp->srv_fd;
+	imp->cli_fd = imp->srv_fd = -1;
+
+	rc->state         = (bridge_state_t)rec->state;
+	rc->fastopen      = rec->fastopen;
+	rc->cli.eof       = rec->cli_eof;
+	rc->cli.shut      = rec->cli_shut;
+	rc->srv.eof       = rec->srv_eof;
+	rc->srv.shut      = rec->srv_shut;
+	rc->created       = (time_t)rec->created;
+	rc->connected     = (time_t)rec->connected;
+	rc->stopping      = (time_t)rec->stopping;
+	rc->connect_start = rec->connect_start;
+	rc->last_io       = rec->last_io;
+
+	ratelimit_adopt(rc->cli.sa.sin_addr.s_addr);
+
+	if (__socket_restore(rc, &rc->cli, imp->data, rec->cli_pending) < 0 ||
+	    __socket_restore(rc, &rc->srv, imp->data + rec->cli_pending, rec->srv_pending) < 0) {
+		LOGGER_DBG( "bridge {%p} has no room for the queued bytes it was handed\n", rc);
+		rc->abort = 1;
+		return sp_free(rc);
+	}
+
+	return rc;
+}
+
+void bridge_shutdown(socket_ctx_t *sock)
+{
+	if (sock->shut)
+		return;
+
+	shutdown(sock->fd, SHUT_WR);
+	sock->shut = 1;
+
+	pipe_pool_put(&sock->pipe);
+	__queue_release(sock);
+	bridge_budget_resume(sock);
+}
+
+int socket_out_is_empty(socket_ctx_t *sock)
+{
+	if (sock->pipe.rfd >= 0)
+		return !sock->pipe.len;
+
+	return queue_is_empty(sock->queue);
+}
+
+int socket_out_is_full(socket_ctx_t *sock)
+{
+	if (sock->pipe.rfd >= 0)
+		return sock->pipe.full || sock->pipe.len >= sock->pipe.size;
+
+	return queue_is_full(sock->queue);
+}
@@ -12,8 +12,16 @@
 #include <time.h>
 
 #include "send_queue.h"
+#include "timer_wheel.h"
+#include "pipe_pool.h"
+#include "zerocopy.h"
+#include "profile.h"
+#include "upgrade.h"
 
+#define CONNECT_TIMEOUT  10
+#define IDLE_TIMEOUT     0
 #define STOPPING_TIMEOUT 30
+#define FASTOPEN_DEFER_MS 50	//!< a client silent for that long gets a SYN without data, servers may speak first
 #define QUEUE_SIZE 32*1024
 
 typedef enum bridge_state_type
@@ -37,8 +45,21 @@ typedef struct socket_context
 	io_status_t read_state;
 	io_status_t write_state;
 	struct sockaddr_in sa;
-	send_queue_t *queue;
-	int eof;
+	send_queue_t *queue;	//!< NULL while there is nothing to send, see bridge_queue()
+	size_t queue_size;	//!< max_size of the queue, kept while the queue is released
+	pipe_t pipe;		//!< splice mode: data on its way to this socket, replaces queue
+	zc_t zc;			//!< MSG_ZEROCOPY sends to this socket
+	int eof;			//!< reading end is done: FIN received
+	int shut;			//!< writing end is done: FIN sent, buffers released
+	int registered;		//!< edge triggered mode: fd is in epoll set
+	int readable;		//!< edge triggered mode: EPOLLIN seen, not drained yet
+	int writable;		//!< edge triggered mode: EPOLLOUT seen, no EAGAIN yet
+	int rdhup;			//!< EPOLLRDHUP seen, peer has closed its writing end
+	int budget_paused;	//!< reads feeding this socket are paused by the memory budget
+	uint64_t budget_since;	//!< io_loop_now() of the pause
+	int shut_wait;		//!< sockmap mode: FIN waits for the kernel to drain the send queue
+	int drain_idle;		//!< sockmap mode: empty send queue samples in a row
+	int unsent;			//!< TCP_NOTSENT_LOWAT mode: bytes the kernel had not sent after the last flush
 } socket_ctx_t;
 
 typedef struct bridge_type
@@ -46,13 +67,92 @@ typedef struct bridge_type
 	socket_ctx_t cli;
 	socket_ctx_t srv;
 	bridge_state_t state;
+	int splice;			//!< both directions go through pipes
+	size_t ring_size;	//!< capacity of ring buffer queues, 0 - node list queues
+	unsigned short listen_port;	//!< the client came in on it
 	time_t created;
 	time_t connected;
 	time_t stopping;
+	uint64_t connect_start;	//!< io_loop_now() of connect(), for the destination health
+	uint64_t last_io;	//!< io_loop_now() of the last io on the bridge, for the idle timer
+	tw_timer_t timer;	//!< connect, idle or stopping timer, depending on state
+	tw_timer_t autosize;	//!< TCP_INFO sampling period
+	int abort;			//!< close both sides with SO_LINGER 0: RST, no TIME_WAIT
+	const profile_t *profile;	//!< socket tuning of both sides, NULL - kernel defaults
+	int sockmap;		//!< 1 - the kernel forwards both directions, -1 - it cannot, 0 - not yet
+	tw_timer_t drain;	//!< sockmap mode: send queue checks of sockets waiting for a FIN
+	int fastopen;		//!< 1 - the SYN toward srv waits for the first write, 2 - it left without data, 0 - done
 } bridge_t;
 
-bridge_t *bridge_create(int cli_fd);
-int bridge_connect(bridge_t *this);
+/*
+ * ring_size: capacity of ring buffer queues, 0 - node list queues of QUEUE_SIZE,
+ *            the ring of the tuning profile replaces it
+ * listen_port: with the destination port it selects the tuning profile
+ *
+ * A new bridge has its client side only, bridge_upstream() adds the srv
+ * socket bound to the client address, ready for bridge_connect(). Lazy
+ * bridges call it once the client has sent something.
+ */
+bridge_t *bridge_create(int cli_fd, size_t ring_size, unsigned short listen_port);
+int bridge_upstream(bridge_t *this);
+
+/*
+ * fastopen: TCP_FASTOPEN_CONNECT on srv. With a cached cookie connect()
+ * returns at once and the SYN leaves with the first write, carrying the
+ * client's first bytes; without one it is a plain connect that asks the
+ * server for a cookie. bridge_fastopen_check() tells which way it went
+ * once the handshake is over and returns 1 then, bridge_fastopen_syn() sends a SYN still
+ * waiting for data without it.
+ */
+int bridge_connect(bridge_t *this, int fastopen);
+int  bridge_fastopen_check(bridge_t *this);
+void bridge_fastopen_syn(bridge_t *this);
 void bridge_set_state(bridge_t *this, bridge_state_t state);
+int bridge_enable_splice(bridge_t *this);
+void bridge_autosize(bridge_t *this, size_t floor, size_t ceil, int sockbuf);
+
+/*
+ * Idle bridges hold no queues: bridge_queue() creates the queue of sock
+ * on demand, bridge_queue_trim() releases it once it is drained. Ring
+ * queues stay until bridge_shutdown(), they are not worth a malloc per
+ * drain.
+ */
+send_queue_t *bridge_queue(bridge_t *this, socket_ctx_t *sock);
+void bridge_queue_trim(socket_ctx_t *sock);
+
+/*
+ * Reads feeding sock must pause: its queue is above its fair share of
+ * a tight memory budget. Tracks pause state and duration for the stats.
+ */
+int  bridge_budget_check(socket_ctx_t *sock);
+void bridge_budget_resume(socket_ctx_t *sock);
+
+/*
+ * sockmap mode. bridge_sockmap() moves an idle bridge into the kernel,
+ * returns 1 once moved, 0 if the bridge is busy and -1 on failure.
+ * bridge_sockmap_drain() sends the FIN of a socket with shut_wait set
+ * once its send queue stays empty, returns 1 while the FIN still waits.
+ */
+int bridge_sockmap(bridge_t *this);
+int bridge_sockmap_drain(socket_ctx_t *sock);
+uint64_t bridge_sockmap_idle(bridge_t *this, uint64_t idle);
+
+/*
+ * Hot upgrade. bridge_export() describes the bridge for the new process
+ * and copies out its queued bytes, toward cli first, into *data, sp_free()
+ * it; the kernel forwarding is taken back first. bridge_import() builds
+ * the bridge anew from what the old process sent, in the state it was
+ * in, and takes the fds of imp over. Contexts, timers and the maps are
+ * up to the caller.
+ */
+int bridge_export(bridge_t *this, upgrade_bridge_t *rec, char **data);
+bridge_t *bridge_import(upgrade_import_t *imp, size_t ring_size);
+
+/* the direction into sock is done: send FIN and give back its buffers */
+void bridge_shutdown(socket_ctx_t *sock);
+
+/* pending output of a socket, from its queue or its pipe */
+int socket_out_is_empty(socket_ctx_t *sock);
+int socket_out_is_full(socket_ctx_t *sock);
 
 #endif /* BRIDGE_H_ */
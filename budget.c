@@ -0,0 +1,56 @@
+/*
+ * budget.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include "budget.h"
+#include "stats.h"
+
+static uint64_t budget_limit  = 0;
+static uint64_t budget_used   = 0;	//!< bytes in all queues
+static uint64_t budget_queues = 0;	//!< queues holding data
+
+void budget_init(uint64_t limit)
+{
+	budget_limit = limit;
+}
+
+void budget_account(size_t before, size_t after)
+{
+	if (before == after)
+		return;
+
+	if (after > before) {
+		__atomic_add_fetch(&budget_used, after - before, __ATOMIC_RELAXED);
+		STATS_ADD(budget_queued, after - before);
+	} else {
+		__atomic_sub_fetch(&budget_used, before - after, __ATOMIC_RELAXED);
+		STATS_SUB(budget_queued, before - after);
+	}
+
+	if (!before)
+		__atomic_add_fetch(&budget_queues, 1, __ATOMIC_RELAXED);
+	else if (!after)
+		__atomic_sub_fetch(&budget_queues, 1, __ATOMIC_RELAXED);
+}
+
+int budget_over_share(size_t size)
+{
+	uint64_t used   = 0;
+	uint64_t queues = 0;
+
+	if (!budget_limit || !size)
+		return 0;
+
+	used = __atomic_load_n(&budget_used, __ATOMIC_RELAXED);
+	if (used * 100 < budget_limit * BUDGET_TIGHT_PCT)
+		return 0;
+
+	queues = __atomic_load_n(&budget_queues, __ATOMIC_RELAXED);
+	if (!queues)
+		queues = 1;
+
+	return size >= budget_limit / queues;
+}
@@ -0,0 +1,29 @@
+/*
+ * budget.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef BUDGET_H_
+#define BUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUDGET_TIGHT_PCT 75	//!< fair sharing kicks in above that much of the budget in use
+
+/*
+ * Process wide budget for queued bytes, shared by all workers. While it
+ * is tight every queue holding data gets an equal share, queues under
+ * their share are never paused, so the biggest consumers stop first.
+ */
+void budget_init(uint64_t limit);
+
+/* a queue went from before to after bytes */
+void budget_account(size_t before, size_t after);
+
+/* reads into a queue of that size should pause */
+int  budget_over_share(size_t size);
+
+#endif /* BUDGET_H_ */
@@ -0,0 +1,98 @@
+/*
+ * buf_pool.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <stddef.h>
+
+#include "buf_pool.h"
+#include "sp.h"
+#include "stats.h"
+
+typedef struct buf_free_type
+{
+	struct buf_free_type *next;
+} buf_free_t;
+
+/* the freelist link lives in the free buffer itself */
+static __thread buf_free_t *freelist[BUF_POOL_CLASSES];
+static __thread int         freenum[BUF_POOL_CLASSES];
+
+static size_t class_size(int cls)
+{
+	return (size_t)1 << (BUF_POOL_MIN_SHIFT + cls * BUF_POOL_CLASS_GAP);
+}
+
+/* smallest class that fits size, -1 if none does */
+static int class_of(size_t size)
+{
+	int cls = 0;
+
+	for (cls = 0; cls < BUF_POOL_CLASSES; cls++)
+		if (size <= class_size(cls))
+			return cls;
+
+	return -1;
+}
+
+size_t buf_pool_class_size(size_t size)
+{
+	int cls = class_of(size);
+
+	return (cls < 0) ? size : class_size(cls);
+}
+
+void *buf_pool_get(size_t size)
+{
+	int cls = class_of(size);
+	buf_free_t *buf = NULL;
+
+	if (cls < 0)
+		return sp_t_malloc(size, NULL, "_buf_");
+
+	if (freelist[cls]) {
+		buf = freelist[cls];
+		freelist[cls] = buf->next;
+		freenum[cls]--;
+		return buf;
+	}
+
+	STATS_INC(bufs_allocated);
+
+	return sp_t_malloc(class_size(cls), NULL, "_buf_");
+}
+
+void buf_pool_put(void *ptr)
+{
+	buf_free_t *buf = (buf_free_t*)ptr;
+	size_t size = sp_getsize(ptr);
+	int cls = class_of(size);
+
+	if (!buf)
+		return;
+
+	if (cls < 0 || class_size(cls) != size || freenum[cls] >= BUF_POOL_MAX_FREE) {
+		sp_free(buf);
+		return;
+	}
+
+	buf->next = freelist[cls];
+	freelist[cls] = buf;
+	freenum[cls]++;
+}
+
+void buf_pool_destroy(void)
+{
+	int cls = 0;
+
+	for (cls = 0; cls < BUF_POOL_CLASSES; cls++) {
+		while (freelist[cls]) {
+			buf_free_t *buf = freelist[cls];
+			freelist[cls] = buf->next;
+			sp_free(buf);
+		}
+		freenum[cls] = 0;
+	}
+}
@@ -0,0 +1,28 @@
+/*
+ * buf_pool.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef BUF_POOL_H_
+#define BUF_POOL_H_
+
+#include <stddef.h>
+
+#define BUF_POOL_CLASSES   3		//!< 4KiB, 16KiB and 64KiB buffers
+#define BUF_POOL_MIN_SHIFT 12
+#define BUF_POOL_CLASS_GAP 2		//!< log2 of the ratio between neighbour classes
+#define BUF_POOL_MAX_FREE  64		//!< cached buffers per class and thread
+
+/*
+ * Per-thread freelists of size-classed sp buffers. buf_pool_get()
+ * rounds the size up to a class, bigger requests are not pooled.
+ * The contents of a buffer from the pool are undefined.
+ */
+void  *buf_pool_get(size_t size);
+void   buf_pool_put(void *buf);
+size_t buf_pool_class_size(size_t size);
+void   buf_pool_destroy(void);
+
+#endif /* BUF_POOL_H_ */
@@ -0,0 +1,345 @@
+/*
+ * config.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "config.h"
+#include "bridge.h"
+#include "logger.h"
+#include "profile.h"
+#include "ratelimit.h"
+#include "health.h"
+
+config_t config = {
+	.ports   = { DEFAULT_PORT },
+	.nports  = 1,
+	.threads = DEFAULT_THREADS,
+
+	.connect_timeout  = CONNECT_TIMEOUT,
+	.idle_timeout     = IDLE_TIMEOUT,
+	.stopping_timeout = STOPPING_TIMEOUT,
+
+	.queue_min = DEFAULT_QUEUE_MIN,
+	.queue_max = DEFAULT_QUEUE_MAX,
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [options]\n"
+	        "  -p, --port <port>        listening port, repeat for more (default %d)\n"
+	        "  -t, --threads <n>        worker threads, one io_loop per thread (default %d)\n"
+	        "  --cpu-affinity           pin worker n to the n-th allowed CPU and hand new\n"
+	        "                           connections to the worker on the CPU that got them\n"
+	        "  -e, --edge               edge triggered epoll for bridge sockets\n"
+	        "  -b, --backend <name>     io backend: epoll or uring (default epoll)\n"
+	        "  -s, --splice             zero-copy forwarding through pipes with splice()\n"
+	        "  --ring <bytes>           ring buffer send queues of that capacity per direction,\n"
+	        "                           0 - lists of pooled buffers (default 0)\n"
+	        "  --zerocopy <bytes>       MSG_ZEROCOPY for queued chunks of at least that size,\n"
+	        "                           node list queues only, 0 - off (default 0)\n"
+	        "  --autosize <ms>          resize queues toward the TCP_INFO bandwidth-delay\n"
+	        "                           product every <ms>, 0 - fixed size (default 0)\n"
+	        "  --autosize-sockbuf       let autosizing set SO_SNDBUF/SO_RCVBUF too\n"
+	        "  --queue-min <bytes>      autosizing floor (default %d)\n"
+	        "  --queue-max <bytes>      autosizing ceiling (default %d)\n"
+	        "  --budget <bytes>         process wide limit for queued data, reads of the\n"
+	        "                           biggest queues pause first, 0 - none (default 0)\n"
+	        "  --sockmap                forward established bridges in the kernel with a BPF\n"
+	        "                           sockmap, needs CAP_BPF and CAP_NET_ADMIN\n"
+	        "  --fastopen               TCP Fast Open toward upstream, the first client\n"
+	        "                           bytes ride in the SYN once a cookie is cached\n"
+	        "  --listen-fastopen <qlen> TCP Fast Open on the listeners, <qlen> pending\n"
+	        "                           fastopen requests, 0 - off (default 0)\n"
+	        "  --defer-accept <sec>     accept clients once they send data, upstream\n"
+	        "                           connects wait for it too, at most <sec> more,\n"
+	        "                           then the server may speak first, 0 - off (default 0)\n"
+	        "  --profile <name:k=v,..>  socket tuning profile, keys nodelay, quickack,\n"
+	        "                           sndbuf, rcvbuf, cc, keepalive, keepintvl, keepcnt,\n"
+	        "                           user_timeout, rcvlowat, notsent_lowat, ring\n"
+	        "  --profile-listen <port=name>       profile for a listening port\n"
+	        "  --profile-dst <port[-port]=name>   profile for destination ports, wins\n"
+	        "                                     over the listening port\n"
+	        "  --rate-limit <cps[:burst]>  new connections per second from one source\n"
+	        "                           address, burst defaults to cps, 0 - no limit\n"
+	        "  --conn-limit <n>         open bridges per source address, 0 - no limit\n"
+	        "  --breaker <n[:ms]>       after <n> failed connects in a row reset new clients\n"
+	        "                           of that destination for <ms>, doubling while probes\n"
+	        "                           fail, 0 - off (default 0, %d ms)\n"
+	        "  --upgrade <path>         hot upgrade socket: take listeners and bridges\n"
+	        "                           over from the process serving <path>, if any,\n"
+	        "                           then serve it for the next binary\n"
+	        "  --connect-timeout <sec>  upstream connect timeout (default %d)\n"
+	        "  --idle-timeout <sec>     drop bridges idle for that long, 0 - never (default %d)\n"
+	        "  --stopping-timeout <sec> drop half closed bridges idle for that long (default %d)\n"
+	        "  -h, --help               show this help\n",
+	        name, DEFAULT_PORT, DEFAULT_THREADS, DEFAULT_QUEUE_MIN, DEFAULT_QUEUE_MAX,
+	        HEALTH_BACKOFF_MS, CONNECT_TIMEOUT, IDLE_TIMEOUT, STOPPING_TIMEOUT);
+}
+
+enum long_only_options
+{
+	OPT_CONNECT_TIMEOUT = 256,
+	OPT_IDLE_TIMEOUT,
+	OPT_STOPPING_TIMEOUT,
+	OPT_RING,
+	OPT_ZEROCOPY,
+	OPT_AUTOSIZE,
+	OPT_AUTOSIZE_SOCKBUF,
+	OPT_QUEUE_MIN,
+	OPT_QUEUE_MAX,
+	OPT_BUDGET,
+	OPT_CPU_AFFINITY,
+	OPT_SOCKMAP,
+	OPT_FASTOPEN,
+	OPT_LISTEN_FASTOPEN,
+	OPT_DEFER_ACCEPT,
+	OPT_RATE_LIMIT,
+	OPT_CONN_LIMIT,
+	OPT_BREAKER,
+	OPT_UPGRADE,
+	OPT_PROFILE,
+	OPT_PROFILE_LISTEN,
+	OPT_PROFILE_DST
+};
+
+static int parse_seconds(const char *arg, const char *name, int allow_zero, int *out)
+{
+	long val = strtol(arg, NULL, 10);
+
+	if (val < 0 || (!val && !allow_zero) || val > 24 * 3600) {
+		LOGGER_ERR("invalid %s {%s}\n", name, arg);
+		return -1;
+	}
+
+	*out = (int)val;
+	return 0;
+}
+
+int config_parse(int ac, char **av)
+{
+	static const struct option options[] = {
+		{ "port",    required_argument, NULL, 'p' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "edge",    no_argument,       NULL, 'e' },
+		{ "backend", required_argument, NULL, 'b' },
+		{ "splice",  no_argument,       NULL, 's' },
+		{ "cpu-affinity",     no_argument,       NULL, OPT_CPU_AFFINITY },
+		{ "connect-timeout",  required_argument, NULL, OPT_CONNECT_TIMEOUT },
+		{ "idle-timeout",     required_argument, NULL, OPT_IDLE_TIMEOUT },
+		{ "stopping-timeout", required_argument, NULL, OPT_STOPPING_TIMEOUT },
+		{ "ring",             required_argument, NULL, OPT_RING },
+		{ "zerocopy",         required_argument, NULL, OPT_ZEROCOPY },
+		{ "autosize",         required_argument, NULL, OPT_AUTOSIZE },
+		{ "autosize-sockbuf", no_argument,       NULL, OPT_AUTOSIZE_SOCKBUF },
+		{ "queue-min",        required_argument, NULL, OPT_QUEUE_MIN },
+		{ "queue-max",        required_argument, NULL, OPT_QUEUE_MAX },
+		{ "budget",           required_argument, NULL, OPT_BUDGET },
+		{ "sockmap",          no_argument,       NULL, OPT_SOCKMAP },
+		{ "fastopen",         no_argument,       NULL, OPT_FASTOPEN },
+		{ "listen-fastopen",  required_argument, NULL, OPT_LISTEN_FASTOPEN },
+		{ "defer-accept",     required_argument, NULL, OPT_DEFER_ACCEPT },
+		{ "rate-limit",       required_argument, NULL, OPT_RATE_LIMIT },
+		{ "conn-limit",       required_argument, NULL, OPT_CONN_LIMIT },
+		{ "breaker",          required_argument, NULL, OPT_BREAKER },
+		{ "upgrade",          required_argument, NULL, OPT_UPGRADE },
+		{ "profile",          required_argument, NULL, OPT_PROFILE },
+		{ "profile-listen",   required_argument, NULL, OPT_PROFILE_LISTEN },
+		{ "profile-dst",      required_argument, NULL, OPT_PROFILE_DST },
+		{ "help",    no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int opt = 0;
+	int ports_set = 0;
+	long val = 0;
+	char *end = NULL;
+
+	while ((opt = getopt_long(ac, av, "p:t:eb:sh", options, NULL)) != -1) {
+		switch (opt) {
+			case 'p':
+				val = strtol(optarg, NULL, 10);
+				if (val <= 0 || val > 65535) {
+					LOGGER_ERR("invalid port {%s}\n", optarg);
+					return -1;
+				}
+				if (!ports_set++)
+					config.nports = 0;
+				if (config.nports >= MAX_LISTENERS) {
+					LOGGER_ERR("too many ports, at most %d\n", MAX_LISTENERS);
+					return -1;
+				}
+				config.ports[config.nports++] = (unsigned short)val;
+				break;
+			case 't':
+				val = strtol(optarg, NULL, 10);
+				if (val <= 0 || val > MAX_THREADS) {
+					LOGGER_ERR("invalid threads number {%s}\n", optarg);
+					return -1;
+				}
+				config.threads = (int)val;
+				break;
+			case 'e':
+				config.edge_triggered = 1;
+				break;
+			case OPT_CPU_AFFINITY:
+				config.cpu_affinity = 1;
+				break;
+			case 'b':
+				if (!strcmp(optarg, "uring"))
+					config.uring = 1;
+				else if (!strcmp(optarg, "epoll"))
+					config.uring = 0;
+				else {
+					LOGGER_ERR("unknown backend {%s}\n", optarg);
+					return -1;
+				}
+				break;
+			case 's':
+				config.splice = 1;
+				break;
+			case OPT_CONNECT_TIMEOUT:
+				if (parse_seconds(optarg, "connect timeout", 0, &config.connect_timeout) < 0)
+					return -1;
+				break;
+			case OPT_IDLE_TIMEOUT:
+				if (parse_seconds(optarg, "idle timeout", 1, &config.idle_timeout) < 0)
+					return -1;
+				break;
+			case OPT_STOPPING_TIMEOUT:
+				if (parse_seconds(optarg, "stopping timeout", 0, &config.stopping_timeout) < 0)
+					return -1;
+				break;
+			case OPT_RING:
+				val = strtol(optarg, NULL, 10);
+				if (val < 0 || val > MAX_RING_SIZE) {
+					LOGGER_ERR("invalid ring size {%s}\n", optarg);
+					return -1;
+				}
+				config.ring_size = (size_t)val;
+				break;
+			case OPT_ZEROCOPY:
+				val = strtol(optarg, NULL, 10);
+				if (val < 0) {
+					LOGGER_ERR("invalid zerocopy threshold {%s}\n", optarg);
+					return -1;
+				}
+				config.zerocopy = (size_t)val;
+				break;
+			case OPT_AUTOSIZE:
+				val = strtol(optarg, NULL, 10);
+				if (val < 0 || val > 3600 * 1000) {
+					LOGGER_ERR("invalid autosize period {%s}\n", optarg);
+					return -1;
+				}
+				config.autosize = (int)val;
+				break;
+			case OPT_AUTOSIZE_SOCKBUF:
+				config.autosize_sockbuf = 1;
+				break;
+			case OPT_QUEUE_MIN:
+			case OPT_QUEUE_MAX:
+				val = strtol(optarg, NULL, 10);
+				if (val < 1024 || val > MAX_RING_SIZE) {
+					LOGGER_ERR("invalid queue size {%s}\n", optarg);
+					return -1;
+				}
+				if (OPT_QUEUE_MIN == opt) config.queue_min = (size_t)val;
+				else                      config.queue_max = (size_t)val;
+				break;
+			case OPT_BUDGET:
+				val = strtol(optarg, NULL, 10);
+				if (val < 0) {
+					LOGGER_ERR("invalid budget {%s}\n", optarg);
+					return -1;
+				}
+				config.budget = (uint64_t)val;
+				break;
+			case OPT_SOCKMAP:
+				config.sockmap = 1;
+				break;
+			case OPT_FASTOPEN:
+				config.fastopen = 1;
+				break;
+			case OPT_LISTEN_FASTOPEN:
+				val = strtol(optarg, NULL, 10);
+				if (val < 0 || val > 65535) {
+					LOGGER_ERR("invalid fastopen queue length {%s}\n", optarg);
+					return -1;
+				}
+				config.listen_fastopen = (int)val;
+				break;
+			case OPT_RATE_LIMIT:
+				val = strtol(optarg, &end, 10);
+				config.rate_burst = 0;
+				if (':' == *end)
+					config.rate_burst = (uint32_t)strtol(end + 1, &end, 10);
+				if (val < 0 || val > RATELIMIT_MAX_BURST || *end || config.rate_burst > RATELIMIT_MAX_BURST) {
+					LOGGER_ERR("invalid rate limit {%s}\n", optarg);
+					return -1;
+				}
+				config.rate_limit = (uint32_t)val;
+				break;
+			case OPT_CONN_LIMIT:
+				val = strtol(optarg, &end, 10);
+				if (val < 0 || val > INT32_MAX || *end) {
+					LOGGER_ERR("invalid connection limit {%s}\n", optarg);
+					return -1;
+				}
+				config.conn_limit = (uint32_t)val;
+				break;
+			case OPT_BREAKER:
+				val = strtol(optarg, &end, 10);
+				config.breaker_backoff = 0;
+				if (':' == *end)
+					config.breaker_backoff = (uint32_t)strtol(end + 1, &end, 10);
+				if (val < 0 || val > INT32_MAX || *end || config.breaker_backoff > HEALTH_MAX_BACKOFF_MS) {
+					LOGGER_ERR("invalid breaker {%s}\n", optarg);
+					return -1;
+				}
+				config.breaker = (uint32_t)val;
+				break;
+			case OPT_UPGRADE:
+				if (!*optarg) {
+					LOGGER_ERR("invalid upgrade socket path {%s}\n", optarg);
+					return -1;
+				}
+				config.upgrade = optarg;
+				break;
+			case OPT_DEFER_ACCEPT:
+				if (parse_seconds(optarg, "defer accept", 1, &config.defer_accept) < 0)
+					return -1;
+				break;
+			case OPT_PROFILE:
+				if (profile_define(optarg) < 0)
+					return -1;
+				break;
+			case OPT_PROFILE_LISTEN:
+				if (profile_bind_listener(optarg) < 0)
+					return -1;
+				break;
+			case OPT_PROFILE_DST:
+				if (profile_bind_dst(optarg) < 0)
+					return -1;
+				break;
+			case 'h':
+			default:
+				usage(av[0]);
+				return -1;
+		}
+	}
+
+	if (config.queue_min > config.queue_max) {
+		LOGGER_ERR("queue min {%zu} is above queue max {%zu}\n", config.queue_min, config.queue_max);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * config.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFAULT_PORT    1025
+#define DEFAULT_THREADS 1
+#define MAX_THREADS     256
+#define MAX_LISTENERS   8
+#define MAX_RING_SIZE   (64*1024*1024)
+#define DEFAULT_QUEUE_MIN (16*1024)
+#define DEFAULT_QUEUE_MAX (4*1024*1024)
+
+typedef struct config_type
+{
+	unsigned short ports[MAX_LISTENERS];	//!< transparent listener ports
+	int nports;
+	int threads;			//!< number of worker threads (one io_loop each)
+	int cpu_affinity;		//!< pin workers to CPUs and steer connections to the worker on the CPU of the SYN
+	int edge_triggered;		//!< register bridge sockets once with EPOLLET
+	int uring;				//!< use io_uring backend (poll, multishot recv) instead of epoll
+	int splice;				//!< forward through pipes with splice() instead of read()/write()
+	size_t ring_size;		//!< per direction ring buffer queue capacity, 0 - node list queues
+	size_t zerocopy;		//!< send queue nodes at least that big with MSG_ZEROCOPY, 0 - never
+	int autosize;			//!< ms between TCP_INFO samples that resize the queues, 0 - fixed QUEUE_SIZE
+	int autosize_sockbuf;	//!< autosizing also sets SO_SNDBUF/SO_RCVBUF
+	size_t queue_min;		//!< autosizing floor
+	size_t queue_max;		//!< autosizing ceiling
+	int sockmap;			//!< forward established bridges in the kernel through a BPF sockmap
+	int fastopen;			//!< TCP_FASTOPEN_CONNECT upstream: the first client bytes go in the SYN
+	int listen_fastopen;	//!< TCP_FASTOPEN queue length of the listeners, 0 - off
+	int defer_accept;		//!< TCP_DEFER_ACCEPT seconds, also makes bridges wait for client data before the upstream, 0 - off
+	uint32_t rate_limit;	//!< connections per second from one source address, 0 - no limit
+	uint32_t rate_burst;	//!< connections a source may open at once above the rate
+	uint32_t conn_limit;	//!< open bridges per source address, 0 - no limit
+	uint32_t breaker;		//!< upstream connect failures in a row that reject a destination for a while, 0 - never
+	uint32_t breaker_backoff;	//!< ms of the first reject window
+	const char *upgrade;	//!< Unix socket path of hot upgrades: take over from the process serving it, then serve it, NULL - off
+	uint64_t budget;		//!< bytes all queues together may hold before fair sharing pauses reads, 0 - no limit
+	int connect_timeout;	//!< seconds for upstream connect to complete
+	int idle_timeout;		//!< seconds without io before an active bridge is dropped, 0 - never
+	int stopping_timeout;	//!< seconds a half closed bridge may stay idle
+} config_t;
+
+extern config_t config;
+
+int config_parse(int ac, char **av);
+
+#endif /* CONFIG_H_ */
@@ -1,13 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "hashmap.h"
 #include "crc.h"
 #include "sp.h"
 
-#define INITIAL_SIZE (2048)
-#define MAX_CHAIN_LENGTH (8)
+#define INITIAL_SIZE (2048)            //!< slots, a power of two; the table never shrinks below it
+#define LOAD_HIGH(n) ((n) - (n) / 4)   //!< entries and tombstones: resize at 75%
+#define LOAD_LOW(n)  ((n) / 8)         //!< entries: shrink below 12.5%
+#ifndef MIGRATE_STEP
+#define MIGRATE_STEP (16)              //!< old slots every put, get and remove moves over
+#endif
+
+#define SLOT_EMPTY 0
+#define SLOT_FULL  1
+#define SLOT_TOMB  2   //!< removed, probes go on past it
 
 /**
  *  We need to keep keys and values
@@ -15,156 +24,385 @@
 typedef struct _hashmap_element
 {
 	char     *key;
-	size_t   in_use;
-	size_t   tbd;     //!< to be deleted
-	any_t    data;
+	any_t     data;
+	uint64_t  hash;    //!< of the key, kept for resizes and cheap compares
+	uint32_t  dist;    //!< probe distance from the home slot, a tombstone keeps it
+	uint32_t  state;
 }hmap_item_t;
 
-/* A hashmap has some maximum size and current size,
- * as well as the data to hold. */
+typedef struct _hashmap_table
+{
+	hmap_item_t *data;
+	size_t       table_size;   //!< power of two
+	size_t       size;         //!< entries
+	size_t       tombs;        //!< tombstones
+}hmap_table_t;
+
+/* A hashmap has the table in use and, while it is resized, the one
+ * being migrated into it, a few slots with every operation. */
 typedef struct _hashmap_map
 {
-	size_t         table_size;
-	size_t         size;
-	hmap_item_t   *data;
+	hmap_table_t    cur;
+	hmap_table_t    old;      //!< data is NULL unless a resize is going on
+	size_t          cursor;   //!< next old slot to migrate
+	hashmap_hash_fn hash;
 }hashmap_map;
 
 
+//---------------------------------------------------------
+// hash functions
+//---------------------------------------------------------
+
+uint64_t hashmap_hash_crc32(const void *key, size_t len)
+{
+	uint32_t hash = crc32_calculate((const uint8_t*)key, len);
+
+	//! Robert Jenkins' 32 bit Mix Function
+	hash += (hash << 12);
+	hash ^= (hash >> 22);
+	hash += (hash << 4);
+	hash ^= (hash >> 9);
+	hash += (hash << 10);
+	hash ^= (hash >> 2);
+	hash += (hash << 7);
+	hash ^= (hash >> 12);
+
+	return hash;
+}
+
+//! wyhash by Wang Yi, public domain, with seed 0 and the default secret
+static const uint64_t wyp[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+static inline void __wymum(uint64_t *a, uint64_t *b)
+{
+	__uint128_t r = (__uint128_t)*a * *b;
+
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t __wymix(uint64_t a, uint64_t b)
+{
+	__wymum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t __wyr8(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t __wyr4(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t __wyr3(const uint8_t *p, size_t k)
+{
+	return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t hashmap_hash_wyhash(const void *key, size_t len)
+{
+	const uint8_t *p    = (const uint8_t*)key;
+	uint64_t       seed = __wymix(wyp[0], wyp[1]);
+	uint64_t       a    = 0;
+	uint64_t       b    = 0;
+
+	if(len <= 16)
+	{
+		if(len >= 4)
+		{
+			a = (__wyr4(p) << 32) | __wyr4(p + ((len >> 3) << 2));
+			b = (__wyr4(p + len - 4) << 32) | __wyr4(p + len - 4 - ((len >> 3) << 2));
+		}
+		else if(len > 0)
+		{
+			a = __wyr3(p, len);
+		}
+	}
+	else
+	{
+		size_t i = len;
+
+		if(i >= 48)
+		{
+			uint64_t see1 = seed, see2 = seed;
+
+			do
+			{
+				seed = __wymix(__wyr8(p) ^ wyp[1], __wyr8(p + 8) ^ seed);
+				see1 = __wymix(__wyr8(p + 16) ^ wyp[2], __wyr8(p + 24) ^ see1);
+				see2 = __wymix(__wyr8(p + 32) ^ wyp[3], __wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while(i >= 48);
+
+			seed ^= see1 ^ see2;
+		}
+
+		while(i > 16)
+		{
+			seed = __wymix(__wyr8(p) ^ wyp[1], __wyr8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = __wyr8(p + i - 16);
+		b = __wyr8(p + i - 8);
+	}
+
+	a ^= wyp[1];
+	b ^= seed;
+	__wymum(&a, &b);
+
+	return __wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+
 //---------------------------------------------------------
 // services
 //---------------------------------------------------------
 
+static int __table_init(hmap_table_t *t, size_t table_size)
+{
+	t->data = sp_t_calloc(table_size*sizeof(hmap_item_t), NULL,"_hashMapItem_");
+	if(!t->data)
+		return MAP_OMEM;
+
+	t->table_size = table_size;
+	t->size       = 0;
+	t->tombs      = 0;
+
+	return MAP_OK;
+}
+
+static void __table_free(hmap_table_t *t)
+{
+	if(!t->data)
+		return;
+
+	for(size_t i=0; i<t->table_size; ++i)
+	{
+		if(SLOT_FULL == t->data[i].state)
+		{
+			sp_free(t->data[i].data);
+			sp_free(t->data[i].key);
+		}
+	}
+	sp_free(t->data);
+	memset(t, 0, sizeof(*t));
+}
+
 //! destructor
 static void __hmap_free(void *ptr)
 {
 	if(!ptr)
 		return;
 	hashmap_map* m = (hashmap_map*)ptr;
-	if(!m)
-		return;
 
-	for(size_t i=0; i<m->table_size; ++i)
+	__table_free(&m->cur);
+	__table_free(&m->old);
+}
+
+/**
+ * Robin Hood probing: an entry further from its home slot takes the
+ * slot of a closer one, which moves on. Probe distances stay short
+ * and a lookup stops at the first slot closer to home than it has
+ * come, tombstones included. A tombstone is taken over by an entry at
+ * least as far from home, the lookups that went past it still do.
+ */
+static hmap_item_t* __find(hmap_table_t *t, const char* key, uint64_t hash)
+{
+	if(!t->data)
+		return NULL;
+
+	size_t mask = t->table_size - 1;
+	size_t curr = hash & mask;
+
+	for(uint32_t dist=0; dist<t->table_size; ++dist)
 	{
-		if(m->data[i].in_use)
-		{
-			sp_free(m->data[i].data);
-			sp_free(m->data[i].key);
-		}
+		hmap_item_t *e = &t->data[curr];
+
+		if(SLOT_EMPTY == e->state || e->dist < dist)
+			break;
+
+		if(SLOT_FULL == e->state && e->hash == hash && !strcmp(e->key,key))
+			return e;
+
+		curr = (curr + 1) & mask;
 	}
-	sp_free(m->data);
+	return NULL;
 }
 
-//! Hashing function for a string
-static uint32_t __hash_internal(hashmap_map* m,const char* keystring)
+//! The key of item is not in t, and t has room for it
+static void __insert(hmap_table_t *t, hmap_item_t item)
 {
-	if (!m || !keystring)
-		return 0;
+	size_t mask = t->table_size - 1;
+	size_t curr = item.hash & mask;
 
-	uint32_t key = crc32_calculate((const uint8_t*)keystring, strlen(keystring));
+	item.dist  = 0;
+	item.state = SLOT_FULL;
 
-	//! Robert Jenkins' 32 bit Mix Function
-	key += (key << 12);
-	key ^= (key >> 22);
-	key += (key << 4);
-	key ^= (key >> 9);
-	key += (key << 10);
-	key ^= (key >> 2);
-	key += (key << 7);
-	key ^= (key >> 12);
-
-	key = (key >> 3) * 2654435761;   /// Knuth's Multiplicative Method
-	return key % m->table_size;
+	for(;;)
+	{
+		hmap_item_t *e = &t->data[curr];
+
+		if(SLOT_EMPTY == e->state)
+			break;
+
+		if(SLOT_TOMB == e->state && e->dist <= item.dist)
+		{
+			t->tombs--;
+			break;
+		}
+
+		if(SLOT_FULL == e->state && e->dist < item.dist)
+		{
+			hmap_item_t tmp = *e;
+			*e   = item;
+			item = tmp;
+		}
+
+		item.dist++;
+		curr = (curr + 1) & mask;
+	}
+
+	t->data[curr] = item;
+	t->size++;
 }
 
-//! Return the integer of the location in data to store the point to the item, or MAP_FULL.
-static uint32_t __hash(map_t* in,const char* key)
+//! Leaves a tombstone, the ones no probe has to go past are cleared
+static void __erase(hmap_table_t *t, hmap_item_t *e)
 {
-	if(!in || !key)
-		return 0;
+	size_t mask = t->table_size - 1;
+	size_t curr = e - t->data;
 
-	hashmap_map* m = (hashmap_map *)in;
+	sp_free(e->data);
+	sp_free(e->key);
 
-	//! If full, return immediately
-	if (m->size >= (m->table_size/2))
-		return MAP_FULL;
+	e->data  = NULL;
+	e->key   = NULL;
+	e->state = SLOT_TOMB;
 
-	//! Find the best index
-	uint32_t curr = __hash_internal(m, key);
+	t->size--;
+	t->tombs++;
 
-	/* Linear probing */
-	for(size_t i=0; i< MAX_CHAIN_LENGTH; ++i)
+	while(SLOT_TOMB == t->data[curr].state && SLOT_EMPTY == t->data[(curr + 1) & mask].state)
 	{
-		if(!m->data[curr].in_use)
-			return curr;
+		t->data[curr].state = SLOT_EMPTY;
+		t->tombs--;
+		curr = (curr - 1) & mask;
+	}
+}
 
-		if(m->data[curr].in_use && !strcmp(m->data[curr].key,key))
-			return curr;
+//! Moves up to steps old slots over into the current table
+static void __migrate(hashmap_map *m, size_t steps)
+{
+	if(!m->old.data)
+		return;
 
-		curr = (curr + 1) % m->table_size;
+	for(; steps && m->cursor < m->old.table_size; --steps, ++m->cursor)
+	{
+		hmap_item_t *e = &m->old.data[m->cursor];
+
+		if(SLOT_FULL != e->state)
+			continue;
+
+		//! the key and the value go as they are, no copies
+		__insert(&m->cur, *e);
+
+		e->data  = NULL;
+		e->key   = NULL;
+		e->state = SLOT_TOMB;
+
+		m->old.size--;
+		m->old.tombs++;
 	}
-	return MAP_FULL;
+
+	if(m->old.size)
+		return;
+
+	sp_free(m->old.data);
+	memset(&m->old, 0, sizeof(m->old));
+	m->cursor = 0;
 }
 
-//! Doubles the size of the hashmap, and rehashes all the elements
-static int __rehash(map_t* in)
+//! Starts migrating into a new table of table_size slots, a migration going on is finished first
+static int __resize(hashmap_map *m, size_t table_size)
 {
-	if(!in)
-		return MAP_OMEM;
+	hmap_table_t t;
+
+	__migrate(m, SIZE_MAX);
 
-	hashmap_map *m = (hashmap_map*)in;
-   
-	//! Setup the new elements
-	hmap_item_t* temp = sp_t_calloc(2*m->table_size*sizeof(hmap_item_t), NULL,"_hashMapItem_");
-	if(!temp)
+	if(MAP_OK != __table_init(&t, table_size))
 		return MAP_OMEM;
 
-	//! Update the array
-	hmap_item_t *curr    = m->data;
-	m->data = temp;
+	m->old    = m->cur;
+	m->cur    = t;
+	m->cursor = 0;
 
-	//! Update the size
-	size_t old_size = m->table_size;
+	//! nothing to migrate, the old table goes right away
+	__migrate(m, 0);
 
-	m->table_size *= 2;
-	m->size        = 0;
+	return MAP_OK;
+}
 
-	//! Rehash the elements
-	for(size_t i=0; i < old_size; ++i)
-	{
-		if(!curr[i].in_use)
-			continue;
+/**
+ * Shrinks the table by half once the entries are down to 12.5%, after
+ * a spike. Grows it once entries and tombstones take 75% of it, or
+ * rebuilds it at the same size if tombstones are most of that.
+ */
+static int __balance(hashmap_map *m)
+{
+	hmap_table_t *t = &m->cur;
 
-		int status = hashmap_put(m, curr[i].key, curr[i].data);
-		if(status != MAP_OK) {
-			sp_free(curr);
-			return status;
-		}
-      
-		sp_free(curr[i].data);
-		sp_free(curr[i].key);
-	}
+	if(!m->old.data && t->table_size > INITIAL_SIZE && t->size < LOAD_LOW(t->table_size))
+		return __resize(m, t->table_size/2);
+
+	if(t->size + t->tombs >= LOAD_HIGH(t->table_size))
+		return __resize(m, (t->size >= t->table_size/2) ? 2*t->table_size : t->table_size);
 
-	sp_free(curr);
 	return MAP_OK;
 }
 
+//! The current table first, then the old one if it is being migrated
+static hmap_item_t* __lookup(hashmap_map *m, const char* key, uint64_t hash, hmap_table_t **table)
+{
+	hmap_item_t *e = __find(&m->cur, key, hash);
+
+	*table = &m->cur;
+	if(e || !m->old.data)
+		return e;
+
+	*table = &m->old;
+	return __find(&m->old, key, hash);
+}
+
 //---------------------------------------------------------
 // interface
 //---------------------------------------------------------
 map_t* hashmap_new(void)
 {
-	hashmap_map* m = sp_t_malloc(sizeof(hashmap_map),__hmap_free,"_hashMap_");
+	return hashmap_new2(hashmap_hash_wyhash);
+}
+
+map_t* hashmap_new2(hashmap_hash_fn hash)
+{
+	hashmap_map* m = sp_t_calloc(sizeof(hashmap_map),__hmap_free,"_hashMap_");
 	do
 	{
-		if(!m)
+		if(!m || !hash)
 			break;
 
-		m->data = sp_t_calloc(INITIAL_SIZE*sizeof(hmap_item_t), NULL,"_hashMapItem_");
-		if(!m->data)
+		if(MAP_OK != __table_init(&m->cur, INITIAL_SIZE))
 			break;
 
-		m->table_size = INITIAL_SIZE;
-		m->size = 0;
+		m->hash = hash;
 
 		return m;
 	} while(0);
@@ -179,24 +417,35 @@ int hashmap_put(map_t* in,char* key, any_t value)
 	if(!in || !key || !value)
 		return MAP_OMEM;
 
-	hashmap_map* m = (hashmap_map *) in;
+	hashmap_map*  m     = (hashmap_map *) in;
+	uint64_t      hash  = m->hash(key, strlen(key));
+	hmap_table_t *table = NULL;
+	hmap_item_t  *e     = NULL;
+	hmap_item_t   item;
 
-	//! Find a place to put our value
-	int idx = __hash(in, key);
-	while(MAP_FULL == idx)
-	{
-		if(MAP_OMEM == __rehash(in))
-			return MAP_OMEM;
+	__migrate(m, MIGRATE_STEP);
 
-		idx = __hash(in,key);
+	//! An existing key keeps its slot, the value is replaced
+	e = __lookup(m, key, hash, &table);
+	if(e)
+	{
+		any_t prev = e->data;
+		e->data = sp_dup(value);
+		sp_free(prev);
+		return MAP_OK;
 	}
 
-	/* Set the data */
-	m->data[idx].data   = sp_dup(value);
-	m->data[idx].key    = sp_strdup(key);
-	m->data[idx].in_use = 1;
-	m->data[idx].tbd    = 0;
-	m->size++; 
+	if(MAP_OK != __balance(m))
+		return MAP_OMEM;
+
+	memset(&item, 0, sizeof(item));
+	item.key  = sp_strdup(key);
+	item.hash = hash;
+	if(!item.key)
+		return MAP_OMEM;
+
+	item.data = sp_dup(value);
+	__insert(&m->cur, item);
 
 	return MAP_OK;
 }
@@ -218,21 +467,17 @@ int hashmap_get(map_t* in,const char* key, any_t *arg)
 	if(!in || !key || !arg)
 		return MAP_OMEM;
 
-	hashmap_map* m    = (hashmap_map*)in;
-	uint32_t     curr = __hash_internal(m, key);    /// Find data location
+	hashmap_map*  m     = (hashmap_map*)in;
+	hmap_table_t *table = NULL;
+	hmap_item_t  *e     = NULL;
+
+	__migrate(m, MIGRATE_STEP);
 
-	//! Linear probing, if necessary
-	for(size_t i=0; i<MAX_CHAIN_LENGTH; ++i)
+	e = __lookup(m, key, m->hash(key, strlen(key)), &table);
+	if(e)
 	{
-		if(m->data[curr].in_use)
-		{
-			if(!strcmp(m->data[curr].key,key))
-			{
-				*arg = sp_dup((m->data[curr].data));
-				return MAP_OK;
-			}
-		}
-		curr = (curr + 1) % m->table_size;
+		*arg = sp_dup(e->data);
+		return MAP_OK;
 	}
 
 	*arg = NULL;
@@ -243,10 +488,10 @@ int hashmap_has(map_t* in,const char* key)
 {
 	if(!in || !key)
 		return 0;
-   
+
 	int   rv  = 0;
 	any_t tmp = NULL;
-   
+
 	hashmap_get(in,key,&tmp);
 	rv = !!tmp;
 	sp_free(tmp);
@@ -258,32 +503,22 @@ int hashmap_remove(map_t* in,const char* key)
 	if(!in || !key)
 		return MAP_OMEM;
 
-	hashmap_map* m    = (hashmap_map*)in;
-	uint32_t     curr = __hash_internal(m, key);  /// Find key
+	hashmap_map*  m     = (hashmap_map*)in;
+	hmap_table_t *table = NULL;
+	hmap_item_t  *e     = NULL;
 
-	//! Linear probing, if necessary
-	for(size_t i=0; i<MAX_CHAIN_LENGTH; ++i)
-	{
-		if(m->data[curr].in_use)
-		{
-			if (strcmp(m->data[curr].key,key)==0)
-			{
-				//! Blank out the fields
-				m->data[curr].in_use = 0;
-            
-				sp_free(m->data[curr].data);
-				sp_free(m->data[curr].key);
-            
-				m->data[curr].data = NULL;
-				m->data[curr].key  = NULL;
-
-				m->size--;       /// Reduce the size
-				return MAP_OK;
-			}
-		}
-		curr = (curr + 1) % m->table_size;
-	}
-	return MAP_MISSING;  /// Data not found
+	__migrate(m, MIGRATE_STEP);
+
+	e = __lookup(m, key, m->hash(key, strlen(key)), &table);
+	if(!e)
+		return MAP_MISSING;  /// Data not found
+
+	__erase(table, e);
+
+	//! the map stays usable if a shrink fails
+	__balance(m);
+
+	return MAP_OK;
 }
 
 int hashmap_remove2(map_t *in, const any_t ptr)
@@ -301,27 +536,36 @@ int hashmap_clear(map_t* in,PFdestruct destructor)
 
 	hashmap_map* m = (hashmap_map*)in;
 
-   //! Linear iterating
-	for(size_t i=0; i<m->table_size; ++i)
+	//! A migration going on is dropped with the old table
+	hmap_table_t *tables[2] = {&m->cur, &m->old};
+
+	for(size_t t=0; t<2; ++t)
 	{
-		if(m->data[i].in_use)
-		{
-			//! Blank out the fields
-			m->data[i].in_use = 0;
+		hmap_table_t *table = tables[t];
 
-			if(destructor)
-				destructor((any_t)m->data[i].data);
-         
-			sp_free(m->data[i].data);
-			sp_free(m->data[i].key);
+		for(size_t i=0; table->data && i<table->table_size; ++i)
+		{
+			if(SLOT_FULL == table->data[i].state && destructor)
+				destructor((any_t)table->data[i].data);
+		}
+	}
 
-			m->data[i].data = NULL;
-			m->data[i].key  = NULL;
+	__table_free(&m->old);
+	m->cursor = 0;
 
-			m->size--;       /// Reduce the size
+	for(size_t i=0; i<m->cur.table_size; ++i)
+	{
+		if(SLOT_FULL == m->cur.data[i].state)
+		{
+			sp_free(m->cur.data[i].data);
+			sp_free(m->cur.data[i].key);
 		}
 	}
-	return MAP_OK;  /// Data not found
+	memset(m->cur.data, 0, m->cur.table_size*sizeof(hmap_item_t));
+	m->cur.size  = 0;
+	m->cur.tombs = 0;
+
+	return MAP_OK;
 }
 
 int hashmap_iterate(map_t* in, PFany f, any_t item)
@@ -333,18 +577,24 @@ int hashmap_iterate(map_t* in, PFany f, any_t item)
 
 	//! On empty hashmap, return immediately
 	if(hashmap_length(m) <= 0)
-		return MAP_MISSING;	
+		return MAP_MISSING;
+
+	hmap_table_t *tables[2] = {&m->cur, &m->old};
 
-	//! Linear probing
-	for(size_t i=0; i<m->table_size; ++i)
+	for(size_t t=0; t<2; ++t)
 	{
-		if(m->data[i].in_use)
+		hmap_table_t *table = tables[t];
+
+		for(size_t i=0; table->data && i<table->table_size; ++i)
 		{
-			any_t data = (any_t)m->data[i].data;
-			int status = f(item, data);
+			if(SLOT_FULL == table->data[i].state)
+			{
+				any_t data = (any_t)table->data[i].data;
+				int status = f(item, data);
 
-			if(status != MAP_OK)
-				return status;
+				if(status != MAP_OK)
+					return status;
+			}
 		}
 	}
 	return MAP_OK;
@@ -360,36 +610,42 @@ int hashmap_cleanByCondition(map_t* in, PFany f, any_t arg, PFdestruct destructo
 
 	//! On empty hashmap, return immediately
 	if(hashmap_length(m) <= 0)
-		return MAP_MISSING;	
+		return MAP_MISSING;
 
-	//! Linear probing
-	for(size_t i=0; i<m->table_size; ++i)
+	//! Removals leave tombstones and never move an entry, the scan sees each one once
+	hmap_table_t *tables[2] = {&m->cur, &m->old};
+
+	for(size_t t=0; t<2; ++t)
 	{
-		if(m->data[i].in_use)
+		hmap_table_t *table = tables[t];
+
+		for(size_t i=0; table->data && i<table->table_size; ++i)
 		{
-			any_t data = (any_t)m->data[i].data;
-			if(MAP_OK == f(arg, data))
+			if(SLOT_FULL == table->data[i].state)
 			{
-				//! Blank out the fields
-				m->data[i].in_use = 0;
-
-				if(destructor)
-					destructor((any_t)m->data[i].data);
-
-				sp_free(m->data[i].data);
-				sp_free(m->data[i].key);
-
-				m->data[i].data = NULL;
-				m->data[i].key  = NULL;
-
-				m->size--;       /// Reduce the size
+				any_t data = (any_t)table->data[i].data;
+				if(MAP_OK == f(arg, data))
+				{
+					if(destructor)
+						destructor(data);
+
+					__erase(table, &table->data[i]);
+				}
 			}
 		}
 	}
+
+	__balance(m);
+
 	return MAP_OK;
 }
 
 size_t hashmap_length(map_t* in)
 {
-	return (!in) ? 0 : (((hashmap_map*)in)->size);
+	if(!in)
+		return 0;
+
+	hashmap_map* m = (hashmap_map*)in;
+
+	return m->cur.size + m->old.size;
 }
@@ -11,6 +11,7 @@
 #define HASHMAP_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define MAP_MISSING -3  /* No such element */
 #define MAP_FULL    -2  /* Hashmap is full */
@@ -38,6 +39,22 @@ typedef int (*PFany)(any_t, any_t);
 typedef void (*PFdestruct)(any_t);
 
 
+/*
+ * hashmap_hash_fn hashes len bytes of a key. The table takes the low
+ * bits of the result, a 32 bit hash will do for up to 2^32 slots.
+ */
+typedef uint64_t (*hashmap_hash_fn)(const void *key, size_t len);
+
+/*
+ * CRC32 with Robert Jenkins' mix, the hash the map always had
+ */
+uint64_t hashmap_hash_crc32(const void *key, size_t len);
+
+/*
+ * wyhash, a few multiplications per 16 bytes, the default
+ */
+uint64_t hashmap_hash_wyhash(const void *key, size_t len);
+
 /*
  * map_t is a pointer to an internally maintained data structure.
  * Clients of this package do not need to know how hashmaps are
@@ -45,13 +62,27 @@ typedef void (*PFdestruct)(any_t);
  */
 typedef void map_t;
 
+/*
+ * Robin Hood open addressing over a power of two table. Removals leave
+ * tombstones, so probe chains stay intact. The table doubles at 75%
+ * load and halves once it is down to 12.5%, after a spike. A resize
+ * does not migrate the entries at once: every put, get and remove moves
+ * a few of them over and lookups check both tables until it is done.
+ */
+
 /*
  * Return an empty hashmap. Returns NULL if empty.
 */
 map_t* hashmap_new(void);
 
+/*
+ * Return an empty hashmap keyed with the hash function given.
+ */
+map_t* hashmap_new2(hashmap_hash_fn hash);
+
 /*
  * Add an element to the hashmap. Return MAP_OK or MAP_OMEM.
+ * An element already there under key is replaced.
  */
 int hashmap_put(map_t* in,char* key, any_t value);
 
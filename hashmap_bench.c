@@ -0,0 +1,161 @@
+/*
+ * hashmap_bench.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+/*
+ * Latency of single hashmap operations while the map grows from empty,
+ * once per hash function: every put, get and remove is timed on its own
+ * and the percentiles are printed. The keys are "%p" strings, the way
+ * the bridge maps used to key their contexts.
+ *
+ *   make bench && ./hashmap_bench [keys]
+ *
+ * hashmap_bench_stw is the same map with the whole migration done by
+ * the first operation after a resize, to compare against.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap.h"
+#include "sp.h"
+
+#define DEFAULT_KEYS 1000000
+#define KEY_LEN      19	//!< 0x1122334455667788 + '\0'
+
+static uint64_t *lat = NULL;
+
+static inline uint64_t __now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int __cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void __report(const char *hash, const char *op, size_t n)
+{
+	uint64_t total = 0;
+	size_t i = 0;
+
+	for (i = 0; i < n; i++)
+		total += lat[i];
+
+	qsort(lat, n, sizeof(lat[0]), __cmp);
+
+	printf("%-7s %-7s %8.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10" PRIu64 "\n",
+	       hash, op, (double)total / n,
+	       lat[n / 2], lat[n * 90 / 100], lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1]);
+}
+
+static int __run(const char *name, hashmap_hash_fn hash, char (*keys)[KEY_LEN], size_t n, any_t value)
+{
+	map_t *map = hashmap_new2(hash);
+	any_t  out = NULL;
+	uint64_t t = 0;
+	size_t i = 0;
+
+	if (!map)
+		return -1;
+
+	/* grows from 2048 slots, every resize happens on the way */
+	for (i = 0; i < n; i++) {
+		t = __now();
+		if (MAP_OK != hashmap_put(map, keys[i], value))
+			break;
+		lat[i] = __now() - t;
+	}
+
+	if (i < n) {
+		sp_free(map);
+		return -1;
+	}
+
+	__report(name, "put", n);
+
+	for (i = 0; i < n; i++) {
+		t = __now();
+		hashmap_get(map, keys[(i * 7919) % n], &out);
+		lat[i] = __now() - t;
+		sp_free(out);
+	}
+
+	__report(name, "get", n);
+
+	/* a spike going away: the map shrinks on the way down */
+	for (i = 0; i < n; i++) {
+		t = __now();
+		hashmap_remove(map, keys[i]);
+		lat[i] = __now() - t;
+	}
+
+	__report(name, "remove", n);
+
+	sp_free(map);
+
+	return 0;
+}
+
+int main(int ac, char **av)
+{
+	size_t n = (ac > 1) ? strtoul(av[1], NULL, 10) : DEFAULT_KEYS;
+	char (*keys)[KEY_LEN] = NULL;
+	any_t value = NULL;
+	size_t i = 0;
+	int rc = 1;
+
+	do {
+		if (!n)
+			break;
+
+		keys  = calloc(n, KEY_LEN);
+		lat   = calloc(n, sizeof(lat[0]));
+		value = sp_malloc(1);
+		if (!keys || !lat || !value)
+			break;
+
+		/* addresses of 256 byte objects, like contexts out of malloc */
+		for (i = 0; i < n; i++)
+			snprintf(keys[i], KEY_LEN, "%p", (void*)(0x7f0000000000ull + i * 256));
+
+		printf("%zu keys, ns per operation\n", n);
+		printf("%-7s %-7s %8s %8s %8s %8s %8s %10s\n", "hash", "op", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+		if (__run("crc32", hashmap_hash_crc32, keys, n, value) < 0)
+			break;
+
+		if (__run("wyhash", hashmap_hash_wyhash, keys, n, value) < 0)
+			break;
+
+		rc = 0;
+	} while(0);
+
+	if (rc)
+		fprintf(stderr, "hashmap_bench failed\n");
+
+	if (value)
+		sp_free(value);
+
+	free(keys);
+	free(lat);
+
+	return rc;
+}
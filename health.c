@@ -0,0 +1,193 @@
+/*
+ * health.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "health.h"
+#include "io_loop.h"
+#include "logger.h"
+#include "stats.h"
+#include "sp.h"
+
+#define FAIL_RATE_ONE 1024	//!< fail_rate of a destination that always fails
+
+typedef enum health_state_type
+{
+	HEALTH_UP = 0,		//!< breaker closed
+	HEALTH_DOWN,		//!< breaker open, rejecting until the window is over
+	HEALTH_PROBING		//!< half open, one connect is on its way
+} health_state_t;
+
+typedef struct health_entry_type
+{
+	uint32_t addr;		//!< destination, 0 - free entry
+	uint16_t port;
+	uint8_t  state;		//!< health_state_t
+	uint8_t  pad;
+	uint32_t fails;		//!< failures in a row
+	uint32_t backoff;	//!< ms of the current reject window
+	uint32_t until;		//!< io_loop_now() the window is over
+	uint32_t stamp;		//!< io_loop_now() of the last use, LRU age
+	uint32_t srtt;		//!< connect latency EWMA, ms << 3
+	uint32_t fail_rate;	//!< failure EWMA, FAIL_RATE_ONE is 100%
+} health_entry_t;
+
+typedef struct health_set_type
+{
+	health_entry_t way[HEALTH_WAYS];
+} __attribute__((aligned(64))) health_set_t;
+
+static uint32_t health_failures = 0;
+static uint32_t health_backoff  = HEALTH_BACKOFF_MS;
+
+static __thread health_set_t *table = NULL;
+
+void health_init(uint32_t failures, uint32_t backoff_ms)
+{
+	health_failures = failures;
+	health_backoff  = (backoff_ms) ? backoff_ms : HEALTH_BACKOFF_MS;
+
+	if (health_backoff > HEALTH_MAX_BACKOFF_MS)
+		health_backoff = HEALTH_MAX_BACKOFF_MS;
+}
+
+int health_attach(void)
+{
+	if (!health_failures)
+		return 0;
+
+	table = sp_calloc(HEALTH_SETS * sizeof(health_set_t));
+
+	return (table) ? 0 : -1;
+}
+
+void health_detach(void)
+{
+	if (table)
+		sp_free(table);
+
+	table = NULL;
+}
+
+static health_set_t *__set(uint32_t addr, uint16_t port)
+{
+	return &table[(uint32_t)((addr ^ ((uint32_t)port << 16)) * 2654435761u) >> (32 - HEALTH_BITS)];
+}
+
+/* free entries go first, then healthy ones, the oldest of them; a tripped breaker stays */
+static int __colder(const health_entry_t *a, const health_entry_t *b, uint32_t now)
+{
+	if (!a->addr != !b->addr)
+		return !a->addr;
+
+	if ((HEALTH_UP == a->state) != (HEALTH_UP == b->state))
+		return HEALTH_UP == a->state;
+
+	return (uint32_t)(now - a->stamp) > (uint32_t)(now - b->stamp);
+}
+
+static health_entry_t *__entry(const struct sockaddr_in *dst, int create, uint32_t now)
+{
+	uint32_t        addr   = dst->sin_addr.s_addr;
+	uint16_t        port   = dst->sin_port;
+	health_set_t   *set    = __set(addr, port);
+	health_entry_t *victim = &set->way[0];
+	int i = 0;
+
+	for (i = 0; i < HEALTH_WAYS; i++) {
+		if (set->way[i].addr == addr && set->way[i].port == port)
+			return &set->way[i];
+
+		if (__colder(&set->way[i], victim, now))
+			victim = &set->way[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	memset(victim, 0, sizeof(*victim));
+	victim->addr  = addr;
+	victim->port  = port;
+	victim->stamp = now;
+
+	return victim;
+}
+
+int health_admit(const struct sockaddr_in *dst)
+{
+	health_entry_t *entry = NULL;
+	uint32_t        now   = 0;
+
+	if (!table)
+		return 0;
+
+	now   = (uint32_t)io_loop_now();
+	entry = __entry(dst, 0, now);
+	if (!entry || HEALTH_UP == entry->state)
+		return 0;
+
+	if ((int32_t)(now - entry->until) < 0)
+		return -1;
+
+	/* the window is over: this one is the probe, the rest wait for it another window */
+	entry->state = HEALTH_PROBING;
+	entry->until = now + entry->backoff;
+	entry->stamp = now;
+
+	LOGGER_DBG( "destination {%s:%d} probe\n", inet_ntoa(dst->sin_addr), ntohs(dst->sin_port));
+
+	return 0;
+}
+
+void health_result(const struct sockaddr_in *dst, int ok, uint32_t latency_ms)
+{
+	health_entry_t *entry = NULL;
+	uint32_t        now   = 0;
+
+	if (!table)
+		return;
+
+	now   = (uint32_t)io_loop_now();
+	entry = __entry(dst, 1, now);
+
+	entry->stamp     = now;
+	entry->fail_rate = entry->fail_rate - entry->fail_rate / 8 + ((ok) ? 0 : FAIL_RATE_ONE / 8);
+
+	if (ok) {
+		entry->srtt = (entry->srtt) ? entry->srtt - entry->srtt / 8 + latency_ms : latency_ms << 3;
+
+		if (HEALTH_UP != entry->state)
+			LOGGER_DBG( "destination {%s:%d} is up again\n", inet_ntoa(dst->sin_addr), ntohs(dst->sin_port));
+
+		entry->state   = HEALTH_UP;
+		entry->fails   = 0;
+		entry->backoff = 0;
+		return;
+	}
+
+	entry->fails++;
+
+	if (HEALTH_PROBING == entry->state) {
+		entry->backoff = (entry->backoff * 2 > HEALTH_MAX_BACKOFF_MS) ? HEALTH_MAX_BACKOFF_MS : entry->backoff * 2;
+	} else if (HEALTH_UP == entry->state && entry->fails >= health_failures) {
+		entry->backoff = health_backoff;
+		STATS_INC(breaker_trips);
+	} else {
+		return;
+	}
+
+	entry->state = HEALTH_DOWN;
+	entry->until = now + entry->backoff;
+
+	LOGGER_DBG( "destination {%s:%d} is down: %u failures, %u%% failing, connect %u ms, rejecting for %u ms\n",
+	            inet_ntoa(dst->sin_addr), ntohs(dst->sin_port), entry->fails,
+	            entry->fail_rate * 100 / FAIL_RATE_ONE, entry->srtt >> 3, entry->backoff);
+}
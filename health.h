@@ -0,0 +1,46 @@
+/*
+ * health.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef HEALTH_H_
+#define HEALTH_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define HEALTH_BITS 10			//!< 1024 sets per worker
+#define HEALTH_SETS (1 << HEALTH_BITS)
+#define HEALTH_WAYS 4			//!< entries of a set, two cache lines
+#define HEALTH_BACKOFF_MS     1000	//!< first reject window after the breaker trips
+#define HEALTH_MAX_BACKOFF_MS 60000	//!< the window doubles with every failed probe up to that
+
+/*
+ * Upstream health per original destination ip:port: a connect latency
+ * EWMA, a failure rate EWMA and a circuit breaker. After --breaker
+ * failures in a row the destination is down for a backoff window, new
+ * bridges to it are reset right away instead of connecting. Once the
+ * window is over one connect goes through as a probe: success closes
+ * the breaker, failure opens it again for twice as long. A probe that
+ * never reports back is replaced by the next one a window later.
+ *
+ * Like the bridges the table is private to a worker, every worker
+ * learns the health of a destination on its own.
+ */
+
+/* process wide, before the workers start; failures 0 - breaker off */
+void health_init(uint32_t failures, uint32_t backoff_ms);
+
+/* worker side table, attached on start and freed on exit */
+int  health_attach(void);
+void health_detach(void);
+
+/* 0 - connect to dst, -1 - the breaker is open */
+int  health_admit(const struct sockaddr_in *dst);
+
+/* outcome of a connect to dst that health_admit() let through */
+void health_result(const struct sockaddr_in *dst, int ok, uint32_t latency_ms);
+
+#endif /* HEALTH_H_ */
@@ -0,0 +1,42 @@
+/*
+ * io_backend.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef IO_BACKEND_H_
+#define IO_BACKEND_H_
+
+#include <sys/epoll.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <stdint.h>
+
+/*
+ * Readiness backend behind the io_loop API. All state is per thread,
+ * every worker initializes its own instance with init().
+ */
+typedef struct io_ops_type
+{
+	const char *name;
+	int  (*init)(void);
+	int  (*add)(int fd, uint32_t events, void *data);
+	int  (*mod)(int fd, uint32_t events, void *data);
+	int  (*del)(int fd);
+	int  (*ring)(int fd);
+	int  (*listen)(int fd);
+	ssize_t (*read)(int fd, const struct iovec *iov, int cnt);
+	int  (*accept)(int fd, struct sockaddr *addr, socklen_t *len);
+	ssize_t (*send)(int fd, const struct msghdr *msg, int flags);
+	ssize_t (*sent)(int fd);
+	int  (*close)(int fd);
+	int  (*wait)(struct epoll_event *events, int max, int timeout);
+	void (*done)(void);
+} io_ops_t;
+
+const io_ops_t *io_uring_ops(void);
+int io_uring_probe(void);
+
+#endif /* IO_BACKEND_H_ */
@@ -5,46 +5,239 @@
  *      Author: vitaliy
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 
 #include "io_loop.h"
+#include "io_backend.h"
 #include "sp.h"
 #include "logger.h"
+#include "stats.h"
+
+/* every worker thread runs its own loop */
+static __thread int efd = -1;
+static __thread io_cb_fn io_cb = NULL;
+static __thread io_cb_fn timer_cb = NULL;
+static __thread int timeout = 100;
+static __thread int initialized = 0;
+
+/* per loop timers, timer_cb is a periodic one among them */
+#define TIMER_TICK_MS 10
+
+static __thread timer_wheel_t *wheel = NULL;
+static __thread tw_timer_t periodic;
+static __thread uint64_t now_ms = 0;
+
+/* events of the batch currently being dispatched */
+static __thread struct epoll_event *batch = NULL;
+static __thread int batch_pos = 0;
+static __thread int batch_num = 0;
+
+/* shared by all loops, io_loop_stop() terminates every worker */
+static volatile int force_exit = 0;
+
+/*
+ * epoll backend
+ */
+static int epoll_init(void)
+{
+	efd = epoll_create1(0);
+	if (efd < 0) {
+		LOGGER_DBG( "epoll_create1() error: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int epoll_mod(int fd, uint32_t events, void *data)
+{
+	struct epoll_event event;
+	int rc = -1;
+
+	do {
+		if (efd < 0)
+			break;
+
+		event.events = events;
+		event.data.ptr = data;
+
+		STATS_INC(epoll_ctls);
+		rc = epoll_ctl(efd, EPOLL_CTL_MOD, fd, &event);
+		if (rc < 0 && ENOENT == errno) {
+			STATS_INC(epoll_ctls);
+			rc = epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event);
+		}
+	} while(0);
+
+	return rc;
+}
+
+static int epoll_add(int fd, uint32_t events, void *data)
+{
+	struct epoll_event event;
+	int rc = -1;
+
+	do {
+		if (efd < 0)
+			break;
+
+		event.events = events;
+		event.data.ptr = data;
+
+		STATS_INC(epoll_ctls);
+		rc = epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event);
+		if (rc < 0 && EEXIST == errno)
+			rc = epoll_mod(fd, events, data);
+	} while(0);
+
+	return rc;
+}
+
+static int epoll_del(int fd)
+{
+	STATS_INC(epoll_ctls);
+	return epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int epoll_ring(int fd)
+{
+	return 0;
+}
+
+static ssize_t epoll_read(int fd, const struct iovec *iov, int cnt)
+{
+	STATS_INC(reads);
+	return readv(fd, iov, cnt);
+}
+
+static int epoll_accept(int fd, struct sockaddr *addr, socklen_t *len)
+{
+	return accept4(fd, addr, len, SOCK_NONBLOCK);
+}
+
+static ssize_t epoll_send(int fd, const struct msghdr *msg, int flags)
+{
+	STATS_INC(writes);
+	return sendmsg(fd, msg, flags);
+}
+
+static ssize_t epoll_sent(int fd)
+{
+	return 0;
+}
+
+static int epoll_wait_events(struct epoll_event *events, int max, int timeout)
+{
+	STATS_INC(epoll_waits);
+	return epoll_wait(efd, events, max, timeout);
+}
+
+static void epoll_done(void)
+{
+	close(efd);
+	efd = -1;
+}
+
+static const io_ops_t epoll_ops = {
+	.name   = "epoll",
+	.init   = epoll_init,
+	.add    = epoll_add,
+	.mod    = epoll_mod,
+	.del    = epoll_del,
+	.ring   = epoll_ring,
+	.listen = epoll_ring,
+	.read   = epoll_read,
+	.accept = epoll_accept,
+	.send   = epoll_send,
+	.sent   = epoll_sent,
+	.close  = close,
+	.wait   = epoll_wait_events,
+	.done   = epoll_done,
+};
+
+/* chosen once at startup, before the workers are running */
+static const io_ops_t *ops = &epoll_ops;
+
+static uint64_t clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void periodic_timer(tw_timer_t *timer, void *arg)
+{
+	io_timer_arm(timer, (uint32_t)timeout, periodic_timer, arg);
 
-static int efd = -1;
-static io_cb_fn io_cb = NULL;
-static io_cb_fn timer_cb = NULL;
-static int timeout = 100;
-static int force_exit = 0;
+	timer_cb(0, NULL);
+}
+
+io_backend_t io_loop_set_backend(io_backend_t backend)
+{
+	if (IO_BACKEND_URING == backend) {
+		if (!io_uring_probe()) {
+			ops = io_uring_ops();
+			return IO_BACKEND_URING;
+		}
+
+		LOGGER_ERR( "%s\n", "io_uring is not usable on this kernel, falling back to epoll");
+	}
+
+	ops = &epoll_ops;
+	return IO_BACKEND_EPOLL;
+}
+
+const char *io_loop_backend_name(void)
+{
+	return ops->name;
+}
 
-int io_loop_init(io_cb_fn io_handler,io_cb_fn timer_handler, int timeout)
+int io_loop_init(io_cb_fn io_handler,io_cb_fn timer_handler, int timeout_ms)
 {
 	int rc = -1;
 
 	do {
-		if (!io_handler || !timer_handler) {
+		if (!io_handler) {
 			LOGGER_DBG( "handlers are not set\n");
 			break;
 		}
 
-		if (efd >= 0) {
+		if (initialized) {
 			LOGGER_DBG( "io_loop has been already initialized\n");
 			break;
 		}
 
-		efd = epoll_create1(0);
-		if (efd < 0) {
-			LOGGER_DBG( "epoll_create1() error: %s\n", strerror(errno));
+		now_ms = clock_ms();
+
+		wheel = timer_wheel_create(TIMER_TICK_MS, now_ms);
+		if (!wheel)
+			break;
+
+		if (ops->init() < 0) {
+			wheel = sp_free(wheel);
 			break;
 		}
 
 		io_cb    = io_handler;
 		timer_cb = timer_handler;
+		timeout  = timeout_ms;
+		initialized = 1;
+
+		memset(&periodic, 0, sizeof(periodic));
+		if (timer_cb && timeout > 0)
+			io_timer_arm(&periodic, (uint32_t)timeout, periodic_timer, NULL);
 
 		rc = 0;
 	} while(0);
@@ -54,38 +247,77 @@ int io_loop_init(io_cb_fn io_handler,io_cb_fn timer_handler, int timeout)
 
 int io_add_sock(int fd, uint32_t events, void *data)
 {
-	return io_mod_sock(fd, events, data);
+	LOGGER_DBG( "io_add_sock: fd {%d} events {%s} {%s}\n", fd,
+	                (events & EPOLLIN)  ? "POLLIN"  : "-",
+	                (events & EPOLLOUT) ? "POLLOUT" : "-");
+
+	if (!initialized)
+		return -1;
+
+	return ops->add(fd, events, data);
 }
 
 int io_mod_sock(int fd, uint32_t events, void *data)
 {
-	struct epoll_event event;
-	int rc = -1;
-
 	LOGGER_DBG( "__io_mod_sock: fd {%d} events {%s} {%s}\n", fd,
 	                (events & EPOLLIN)  ? "POLLIN"  : "-",
 	                (events & EPOLLOUT) ? "POLLOUT" : "-");
 
-	do {
-		if (efd < 0)
-			break;
-
-		event.events = events;
-		event.data.ptr = data;
-
-		rc = epoll_ctl(efd, EPOLL_CTL_MOD, fd, &event);
-		if (rc < 0 && ENOENT == errno)
-			rc = epoll_ctl(efd, EPOLL_CTL_ADD, fd, &event);
-	} while(0);
+	if (!initialized)
+		return -1;
 
-	return rc;
+	return ops->mod(fd, events, data);
 }
 
 int io_del_sock(int fd)
 {
 	LOGGER_DBG( "io_del_sock: fd {%d}\n", fd);
 
-	return epoll_ctl(efd, EPOLL_CTL_DEL, fd, NULL);
+	if (!initialized)
+		return -1;
+
+	return ops->del(fd);
+}
+
+int io_ring_sock(int fd)
+{
+	if (!initialized)
+		return -1;
+
+	return ops->ring(fd);
+}
+
+int io_ring_listener(int fd)
+{
+	if (!initialized)
+		return -1;
+
+	return ops->listen(fd);
+}
+
+ssize_t io_read_sock(int fd, const struct iovec *iov, int cnt)
+{
+	return ops->read(fd, iov, cnt);
+}
+
+int io_accept_sock(int fd, struct sockaddr *addr, socklen_t *len)
+{
+	return ops->accept(fd, addr, len);
+}
+
+ssize_t io_send_sock(int fd, const struct msghdr *msg, int flags)
+{
+	return ops->send(fd, msg, flags);
+}
+
+ssize_t io_send_done(int fd)
+{
+	return ops->sent(fd);
+}
+
+int io_close_sock(int fd)
+{
+	return ops->close(fd);
 }
 
 void io_loop_run(void)
@@ -93,6 +325,7 @@ void io_loop_run(void)
 #define MAXEVENTS 100
 
 	int n = 0, i = 0;
+	int64_t wait_ms = 0;
 	struct epoll_event *events = NULL;
 
 	events = sp_t_calloc(MAXEVENTS * sizeof(struct epoll_event), NULL, "_epoll_events_");
@@ -100,32 +333,83 @@ void io_loop_run(void)
 		return;
 
 	while (!force_exit) {
-		timer_cb(0,NULL);
+		now_ms = clock_ms();
+		timer_wheel_advance(wheel, now_ms);
 
-		n = epoll_wait(efd, events, MAXEVENTS, timeout);
+		/* never sleep longer than timeout, io_loop_stop() has to be noticed */
+		wait_ms = timer_wheel_next(wheel, now_ms);
+		if (wait_ms < 0 || (timeout > 0 && wait_ms > timeout))
+			wait_ms = timeout;
+
+		n = ops->wait(events, MAXEVENTS, (int)wait_ms);
 		if (!n || (n < 0 && errno == EINTR))
 			continue;
 
+		now_ms = clock_ms();
+
 		if (n < 0) {
-			LOGGER_DBG( "epoll_wait failed: %s\n", strerror(errno));
+			LOGGER_DBG( "%s wait failed: %s\n", ops->name, strerror(errno));
 			break;
 		}
 
+		batch     = events;
+		batch_num = n;
+
 		for (i = 0; i < n; i++) {
 			if (!events[i].events)
 				continue;
+
+			batch_pos = i;
 			io_cb(events[i].events, events[i].data.ptr);
 		}
+
+		batch     = NULL;
+		batch_num = 0;
 	}
 
 	sp_free(events);
-	close(efd);
-	efd = -1;
+	ops->done();
+	wheel = sp_free(wheel);
+	initialized = 0;
 
 	return;
 }
 
+uint64_t io_loop_now(void)
+{
+	return now_ms;
+}
+
+void io_timer_arm(tw_timer_t *timer, uint32_t timeout_ms, tw_cb_fn cb, void *arg)
+{
+	timer_wheel_arm(wheel, timer, now_ms, timeout_ms, cb, arg);
+}
+
+void io_timer_cancel(tw_timer_t *timer)
+{
+	timer_wheel_cancel(wheel, timer);
+}
+
+void io_loop_forget(void *data)
+{
+	int i = 0;
+
+	if (!batch || !data)
+		return;
+
+	/* the object is going away, drop its events still waiting in this batch */
+	for (i = batch_pos + 1; i < batch_num; i++) {
+		if (batch[i].data.ptr == data)
+			batch[i].events = 0;
+	}
+}
+
 void io_loop_stop(void)
 {
-	force_exit++;
+	__atomic_store_n(&force_exit, 1, __ATOMIC_RELAXED);
+}
+
+int io_loop_stopped(void)
+{
+	return __atomic_load_n(&force_exit, __ATOMIC_RELAXED);
 }
@@ -9,19 +9,69 @@
 #define IO_LOOP_H_
 
 #include <sys/epoll.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 #include <stdint.h>
 
 #include "socket_context.h"
+#include "timer_wheel.h"
 
 typedef void (*io_cb_fn) (uint32_t events, void *ctx);
 
+typedef enum io_backend_type
+{
+	IO_BACKEND_EPOLL = 1,
+	IO_BACKEND_URING
+} io_backend_t;
+
 int io_add_sock(int fd, uint32_t events, void *data);
 int io_del_sock(int fd);
 int io_mod_sock(int fd, uint32_t events, void *data);
+void io_loop_forget(void *data);
+
+/*
+ * A registered socket read with io_read_sock() and written with
+ * io_send_sock() only. io_uring receives ahead into its provided
+ * buffers, EPOLLIN then reports data already in userspace and EOF
+ * shows up as a read of 0, never as EPOLLRDHUP. A send is queued to
+ * the ring and goes out with the next wait: io_send_sock() returns 0,
+ * EPOLLOUT follows and io_send_done() tells the bytes sent (-1 with
+ * EALREADY while it is on its way). epoll reads and writes right away,
+ * io_send_done() is always 0 there.
+ */
+int     io_ring_sock(int fd);
+ssize_t io_read_sock(int fd, const struct iovec *iov, int cnt);
+ssize_t io_send_sock(int fd, const struct msghdr *msg, int flags);
+ssize_t io_send_done(int fd);
+
+/*
+ * A registered listener accepted from with io_accept_sock() only, the
+ * fds come nonblocking. io_uring accepts ahead with a multishot accept,
+ * addr is filled in only if asked for.
+ */
+int io_ring_listener(int fd);
+int io_accept_sock(int fd, struct sockaddr *addr, socklen_t *len);
+
+/* closed with the next wait on io_uring, right away on epoll */
+int io_close_sock(int fd);
+
+io_backend_t io_loop_set_backend(io_backend_t backend);
+const char  *io_loop_backend_name(void);
 
+/*
+ * timer_handler (optional) is called every timeout ms, the loop sleeps
+ * until the nearest timer instead of waking up at a fixed rate
+ */
 int  io_loop_init(io_cb_fn io_handler, io_cb_fn timer_handler, int timeout);
 void io_loop_run(void);
 void io_loop_stop(void);
+int  io_loop_stopped(void);
+
+/* loop time in ms (monotonic), refreshed on every wakeup */
+uint64_t io_loop_now(void);
+void io_timer_arm(tw_timer_t *timer, uint32_t timeout_ms, tw_cb_fn cb, void *arg);
+void io_timer_cancel(tw_timer_t *timer);
 
 
 #endif /* IO_LOOP_H_ */
@@ -0,0 +1,1373 @@
+/*
+ * io_uring.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "io_backend.h"
+#include "sp.h"
+#include "logger.h"
+#include "stats.h"
+
+/*
+ * io_uring backend.
+ *
+ * Every registered fd owns a poll request on the ring. Level triggered
+ * interest is a oneshot poll which is re-armed after each completion,
+ * EPOLLET interest is a multishot poll. Interest changes are queued as
+ * SQEs and go to the kernel together with the next wait, so flipping
+ * EPOLLIN/EPOLLOUT costs no syscall of its own.
+ *
+ * Sockets handed over with io_ring_sock() are read ahead: a multishot
+ * recv fills buffers of the provided buffer ring and EPOLLIN reports
+ * data already in userspace, io_read_sock() copies it out and gives the
+ * buffers back. Their poll request leaves EPOLLIN to the recv. A socket
+ * holding URING_SLOT_BUFS buffers has its recv cancelled until it is
+ * read, the rest waits in the kernel. With the ring out of buffers the
+ * socket falls back to poll and readv() until it is drained.
+ *
+ * Their writes are SENDMSG requests with MSG_DONTWAIT, one per socket
+ * at a time, and closes are CLOSE requests. Both go out with the next
+ * wait and complete right there, a send reports its result as EPOLLOUT.
+ *
+ * Listeners handed over with io_ring_listener() get a multishot accept,
+ * accepted fds wait on the slot for io_accept_sock() the same way.
+ *
+ * Each of recv, send, accept and close is used only if the kernel has
+ * it, see io_uring_probe(), and falls back to the plain syscall.
+ *
+ * user_data carries the fd, a per fd generation and the request kind,
+ * completions of a request that has been removed or replaced are
+ * recognized and dropped, their buffers go back to the ring.
+ */
+
+#define URING_ENTRIES     1024
+#define URING_IGNORE      ((uint64_t)-1)
+#define URING_MIN_SLOTS   1024
+#define URING_PROBE_OPS   256
+
+#define URING_BUFS        256		//!< provided buffers per worker, a power of two
+#define URING_BUF_SIZE    16384
+#define URING_BUF_GROUP   0
+#define URING_SLOT_BUFS   4			//!< buffers a socket holds before its recv is cancelled
+#define URING_SLOT_FDS    64		//!< accepted fds a listener holds before its accept is cancelled
+#define URING_SEND_IOV    64		//!< iovecs of one SENDMSG, the rest goes with the next
+
+#define URING_KIND_POLL   (0ull << 62)
+#define URING_KIND_RECV   (1ull << 62)
+#define URING_KIND_SEND   (2ull << 62)
+#define URING_KIND_ACCEPT (3ull << 62)
+#define URING_KIND_MASK   (3ull << 62)
+#define URING_GEN_MASK    0x3fffffffu
+
+#define URING_REQUIRED_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+/* what the kernel can do for us besides polling, see io_uring_probe() */
+#define URING_CAP_RECV    0x01		//!< multishot recv into a provided buffer ring
+#define URING_CAP_SEND    0x02		//!< SENDMSG
+#define URING_CAP_ACCEPT  0x04		//!< multishot accept
+#define URING_CAP_CLOSE   0x08		//!< CLOSE
+
+/* multishot recv or accept states */
+#define URING_MS_OFF      0		//!< plain poll and readv() / accept4()
+#define URING_MS_IDLE     1		//!< nothing outstanding, armed again once read
+#define URING_MS_ARMED    2		//!< multishot request outstanding
+#define URING_MS_CANCEL   3		//!< request being cancelled, the slot holds enough
+#define URING_MS_POLL     4		//!< out of buffers or fds, poll and the syscall until EAGAIN
+#define URING_MS_DONE     5		//!< recv got EOF or an error, ms_err tells
+
+/* send states */
+#define URING_SEND_NONE   0
+#define URING_SEND_QUEUED 1		//!< SENDMSG queued or on its way
+#define URING_SEND_DONE   2		//!< send_res waits for io_send_done()
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+#define URING_POLL_MASK(_e) (((_e) << 16) | ((_e) >> 16))
+#else
+#define URING_POLL_MASK(_e) (_e)
+#endif
+
+/* a SENDMSG reads its msghdr when it is submitted, it lives here till then */
+typedef struct uring_send_type
+{
+	struct msghdr msg;
+	struct iovec  iov[URING_SEND_IOV];
+} uring_send_t;
+
+typedef struct uring_slot_type
+{
+	void     *data;		//!< io_loop cookie, NULL when fd is not registered
+	uint32_t  events;	//!< requested epoll events
+	uint32_t  gen;		//!< generation of the outstanding poll request
+	uint32_t  mask;		//!< events of the outstanding poll request
+	int       armed;	//!< poll request is outstanding
+	int       quiet;	//!< level triggered slot parked on a multishot poll
+
+	int       listener;	//!< multishot accept instead of recv
+	int       ms;		//!< URING_MS_* state
+	int       ms_err;	//!< errno the recv ended with, 0 - EOF
+	uint32_t  mgen;		//!< generation of the outstanding multishot request
+	int       held;		//!< received buffers or accepted fds not read yet
+	uint16_t  head;		//!< first of them, while held
+	uint16_t  tail;		//!< last of them
+	uint32_t  off;		//!< bytes of head already read
+	int      *fds;		//!< accepted fds of a listener, fds_num of them in a ring
+	uint32_t  fds_num;	//!< a power of two, grows with a backlog taken at once
+	int       ready;	//!< on the ready list
+	int       next;		//!< next fd on the ready list, -1 - end
+
+	int       ringed;	//!< writes go through the ring
+	int       send;		//!< URING_SEND_* state
+	int       send_res;	//!< bytes sent or -errno, EAGAIN turns 0 once EPOLLOUT follows
+	uint32_t  sgen;		//!< generation of the outstanding send
+	unsigned  send_pos;	//!< its SQ position, it is a NOP until submitted if the fd goes
+	uring_send_t *sbuf;
+
+	uint32_t  seq;		//!< wait the slot has been reported in
+	int       idx;		//!< its event in that wait
+} uring_slot_t;
+
+typedef struct uring_type
+{
+	int fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned  sq_entries;
+	unsigned  sq_local_tail;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void   *sq_ptr;
+	size_t  sq_size;
+	void   *cq_ptr;
+	size_t  cq_size;
+	size_t  sqes_size;
+
+	uring_slot_t *slots;
+	size_t        slots_num;
+
+	struct io_uring_buf_ring *br;	//!< provided buffer ring
+	uint16_t  br_tail;
+	char     *bufs;					//!< URING_BUFS buffers of URING_BUF_SIZE
+	uint16_t  buf_next[URING_BUFS];	//!< received buffers of a slot, in order
+	uint32_t  buf_len[URING_BUFS];
+
+	int       ready;		//!< level triggered slots holding data or EOF, -1 - none
+	uint32_t  seq;			//!< current wait
+	int       caps;			//!< URING_CAP_* of this worker, the kernel may turn some off
+} uring_t;
+
+static __thread uring_t ring = { .fd = -1, .ready = -1 };
+
+/* probed once at startup, before the workers are running */
+static int uring_caps = 0;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int uring_register_buffers(int fd, void *br, unsigned entries)
+{
+	struct io_uring_buf_reg reg;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr    = (uint64_t)(uintptr_t)br;
+	reg.ring_entries = entries;
+	reg.bgid         = URING_BUF_GROUP;
+
+	return sys_io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+}
+
+static void uring_unmap(void)
+{
+	if (ring.sqes && MAP_FAILED != (void*)ring.sqes)
+		munmap(ring.sqes, ring.sqes_size);
+
+	if (ring.cq_ptr && MAP_FAILED != ring.cq_ptr && ring.cq_ptr != ring.sq_ptr)
+		munmap(ring.cq_ptr, ring.cq_size);
+
+	if (ring.sq_ptr && MAP_FAILED != ring.sq_ptr)
+		munmap(ring.sq_ptr, ring.sq_size);
+
+	if (ring.br && MAP_FAILED != (void*)ring.br)
+		munmap(ring.br, URING_BUFS * sizeof(struct io_uring_buf));
+
+	if (ring.bufs && MAP_FAILED != (void*)ring.bufs)
+		munmap(ring.bufs, (size_t)URING_BUFS * URING_BUF_SIZE);
+
+	ring.sqes   = NULL;
+	ring.cq_ptr = NULL;
+	ring.sq_ptr = NULL;
+	ring.br     = NULL;
+	ring.bufs   = NULL;
+}
+
+/* a buffer read out (or never handed out) goes back to the kernel */
+static void uring_buf_put(unsigned bid)
+{
+	struct io_uring_buf *buf = &ring.br->bufs[ring.br_tail & (URING_BUFS - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)(ring.bufs + (size_t)bid * URING_BUF_SIZE);
+	buf->len  = URING_BUF_SIZE;
+	buf->bid  = (uint16_t)bid;
+
+	ring.br_tail++;
+	__atomic_store_n(&ring.br->tail, ring.br_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_buffers_init(void)
+{
+	unsigned i = 0;
+
+	ring.br = mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+	               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == (void*)ring.br)
+		return -1;
+
+	ring.bufs = mmap(NULL, (size_t)URING_BUFS * URING_BUF_SIZE, PROT_READ | PROT_WRITE,
+	                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == (void*)ring.bufs)
+		return -1;
+
+	if (uring_register_buffers(ring.fd, ring.br, URING_BUFS) < 0)
+		return -1;
+
+	ring.br_tail = 0;
+	for (i = 0; i < URING_BUFS; i++)
+		uring_buf_put(i);
+
+	return 0;
+}
+
+static void uring_release(void)
+{
+	size_t i = 0;
+
+	uring_unmap();
+
+	if (ring.fd >= 0)
+		close(ring.fd);
+	ring.fd = -1;
+
+	for (i = 0; ring.slots && i < ring.slots_num; i++) {
+		if (ring.slots[i].fds)
+			sp_free(ring.slots[i].fds);
+		if (ring.slots[i].sbuf)
+			sp_free(ring.slots[i].sbuf);
+	}
+
+	if (ring.slots)
+		sp_free(ring.slots);
+
+	ring.slots = NULL;
+	ring.slots_num = 0;
+	ring.ready = -1;
+}
+
+static int uring_init(void)
+{
+	struct io_uring_params params;
+	int rc = -1;
+
+	do {
+		if (ring.fd >= 0)
+			break;
+
+		memset(&params, 0, sizeof(params));
+
+		ring.fd = sys_io_uring_setup(URING_ENTRIES, &params);
+		if (ring.fd < 0) {
+			LOGGER_DBG( "io_uring_setup() error: %s\n", strerror(errno));
+			break;
+		}
+
+		if ((params.features & URING_REQUIRED_FEATURES) != URING_REQUIRED_FEATURES) {
+			LOGGER_DBG( "io_uring features {%x} are missing\n", URING_REQUIRED_FEATURES & ~params.features);
+			errno = EOPNOTSUPP;
+			break;
+		}
+
+		ring.sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		ring.cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			if (ring.cq_size > ring.sq_size)
+				ring.sq_size = ring.cq_size;
+			ring.cq_size = ring.sq_size;
+		}
+
+		ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                   ring.fd, IORING_OFF_SQ_RING);
+		if (MAP_FAILED == ring.sq_ptr)
+			break;
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			ring.cq_ptr = ring.sq_ptr;
+		} else {
+			ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			                   ring.fd, IORING_OFF_CQ_RING);
+			if (MAP_FAILED == ring.cq_ptr)
+				break;
+		}
+
+		ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                 ring.fd, IORING_OFF_SQES);
+		if (MAP_FAILED == (void*)ring.sqes)
+			break;
+
+		ring.sq_head    = (unsigned*)((char*)ring.sq_ptr + params.sq_off.head);
+		ring.sq_tail    = (unsigned*)((char*)ring.sq_ptr + params.sq_off.tail);
+		ring.sq_mask    = (unsigned*)((char*)ring.sq_ptr + params.sq_off.ring_mask);
+		ring.sq_array   = (unsigned*)((char*)ring.sq_ptr + params.sq_off.array);
+		ring.sq_entries = params.sq_entries;
+		ring.sq_local_tail = *ring.sq_tail;
+
+		ring.cq_head = (unsigned*)((char*)ring.cq_ptr + params.cq_off.head);
+		ring.cq_tail = (unsigned*)((char*)ring.cq_ptr + params.cq_off.tail);
+		ring.cq_mask = (unsigned*)((char*)ring.cq_ptr + params.cq_off.ring_mask);
+		ring.cqes    = (struct io_uring_cqe*)((char*)ring.cq_ptr + params.cq_off.cqes);
+
+		ring.slots = sp_t_calloc(URING_MIN_SLOTS * sizeof(uring_slot_t), NULL, "_uring_slot_t_");
+		if (!ring.slots)
+			break;
+
+		ring.slots_num = URING_MIN_SLOTS;
+		ring.ready     = -1;
+		ring.caps      = uring_caps;
+
+		/* no buffers, no recv: the worker reads with readv() */
+		if ((ring.caps & URING_CAP_RECV) && uring_buffers_init() < 0) {
+			LOGGER_DBG( "io_uring provided buffer ring error: %s\n", strerror(errno));
+			ring.caps &= ~URING_CAP_RECV;
+		}
+
+		rc = 0;
+	} while(0);
+
+	if (rc < 0) {
+		LOGGER_ERR( "failed to set up io_uring: %s\n", strerror(errno));
+		uring_release();
+	}
+
+	return rc;
+}
+
+/* push queued SQEs to the kernel and optionally wait for completions */
+static int uring_enter(unsigned min_complete, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned flags = 0;
+	unsigned to_submit = 0;
+	int rc = 0;
+
+	__atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+	if (!to_submit && !min_complete)
+		return 0;
+
+	memset(&arg, 0, sizeof(arg));
+
+	if (min_complete) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		arg.sigmask_sz = _NSIG / 8;
+
+		if (timeout >= 0) {
+			ts.tv_sec  = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000L;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+
+	STATS_INC(uring_enters);
+	STATS_ADD(uring_sqes, to_submit);
+
+	rc = sys_io_uring_enter(ring.fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+	if (rc < 0 && (ETIME == errno || EINTR == errno || EBUSY == errno || EAGAIN == errno))
+		rc = 0;
+
+	return rc;
+}
+
+static void uring_done(void)
+{
+	/* queued closes must not be lost with the ring */
+	if (ring.fd >= 0)
+		uring_enter(0, 0);
+
+	uring_release();
+}
+
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe = NULL;
+	unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+	unsigned idx  = 0;
+
+	if (ring.sq_local_tail - head >= ring.sq_entries) {
+		/* submission queue is full, hand it over to the kernel now */
+		if (uring_enter(0, 0) < 0)
+			return NULL;
+
+		head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		if (ring.sq_local_tail - head >= ring.sq_entries)
+			return NULL;
+	}
+
+	idx = ring.sq_local_tail & *ring.sq_mask;
+	sqe = &ring.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	ring.sq_array[idx] = idx;
+	ring.sq_local_tail++;
+
+	return sqe;
+}
+
+/*
+ * Multishot poll (5.13) has no opcode of its own to probe: arm one on
+ * a pipe that is writable already, it has to complete and stay armed.
+ */
+static int uring_probe_multishot(void)
+{
+	struct io_uring_sqe *sqe = NULL;
+	struct io_uring_cqe *cqe = NULL;
+	int pfd[2] = { -1, -1 };
+	int rc = -1;
+
+	do {
+		if (pipe2(pfd, O_NONBLOCK) < 0)
+			break;
+
+		sqe = uring_get_sqe();
+		if (!sqe)
+			break;
+
+		sqe->opcode        = IORING_OP_POLL_ADD;
+		sqe->fd            = pfd[1];
+		sqe->poll32_events = URING_POLL_MASK(POLLOUT);
+		sqe->len           = IORING_POLL_ADD_MULTI;
+
+		if (uring_enter(1, 1000) < 0)
+			break;
+
+		if (*ring.cq_head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+			break;
+
+		cqe = &ring.cqes[*ring.cq_head & *ring.cq_mask];
+		if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE))
+			rc = 0;
+		else
+			LOGGER_DBG( "io_uring multishot poll is not supported: %d\n", cqe->res);
+	} while(0);
+
+	if (pfd[0] >= 0)
+		close(pfd[0]);
+	if (pfd[1] >= 0)
+		close(pfd[1]);
+
+	return rc;
+}
+
+int io_uring_probe(void)
+{
+	struct io_uring_probe *probe = NULL;
+	int rc = -1;
+
+	uring_caps = 0;
+
+	do {
+		if (uring_init() < 0)
+			break;
+
+		probe = sp_t_calloc(sizeof(*probe) + URING_PROBE_OPS * sizeof(probe->ops[0]), NULL, "_uring_probe_");
+		if (!probe)
+			break;
+
+		if (sys_io_uring_register(ring.fd, IORING_REGISTER_PROBE, probe, URING_PROBE_OPS) < 0) {
+			LOGGER_DBG( "io_uring opcode probe error: %s\n", strerror(errno));
+			break;
+		}
+
+#define URING_HAS_OP(_op) ((_op) <= probe->last_op && (probe->ops[(_op)].flags & IO_URING_OP_SUPPORTED))
+
+		if (!URING_HAS_OP(IORING_OP_POLL_ADD) || !URING_HAS_OP(IORING_OP_POLL_REMOVE) ||
+		    !URING_HAS_OP(IORING_OP_ASYNC_CANCEL) || !URING_HAS_OP(IORING_OP_NOP)) {
+			LOGGER_DBG( "%s\n", "io_uring poll opcodes are not supported");
+			break;
+		}
+
+		if (uring_probe_multishot() < 0)
+			break;
+
+		/* multishot recv (6.0) and accept (5.19) are found out on the way, see EINVAL */
+		if (URING_HAS_OP(IORING_OP_RECV) && !uring_buffers_init())
+			uring_caps |= URING_CAP_RECV;
+		if (URING_HAS_OP(IORING_OP_SENDMSG))
+			uring_caps |= URING_CAP_SEND;
+		if (URING_HAS_OP(IORING_OP_ACCEPT))
+			uring_caps |= URING_CAP_ACCEPT;
+		if (URING_HAS_OP(IORING_OP_CLOSE))
+			uring_caps |= URING_CAP_CLOSE;
+
+#undef URING_HAS_OP
+
+		LOGGER_DBG( "io_uring recv {%s} send {%s} accept {%s} close {%s}\n",
+		            (uring_caps & URING_CAP_RECV)   ? "yes" : "no",
+		            (uring_caps & URING_CAP_SEND)   ? "yes" : "no",
+		            (uring_caps & URING_CAP_ACCEPT) ? "yes" : "no",
+		            (uring_caps & URING_CAP_CLOSE)  ? "yes" : "no");
+
+		rc = 0;
+	} while(0);
+
+	if (probe)
+		sp_free(probe);
+
+	uring_release();
+
+	return rc;
+}
+
+static uring_slot_t *uring_slot(int fd)
+{
+	size_t num = 0;
+
+	if (fd < 0)
+		return NULL;
+
+	if ((size_t)fd < ring.slots_num)
+		return &ring.slots[fd];
+
+	num = ring.slots_num;
+	while (num <= (size_t)fd)
+		num *= 2;
+
+	uring_slot_t *slots = sp_realloc(ring.slots, num * sizeof(uring_slot_t));
+	if (!slots || sp_getsize(slots) < num * sizeof(uring_slot_t))
+		return NULL;
+
+	memset(&slots[ring.slots_num], 0, (num - ring.slots_num) * sizeof(uring_slot_t));
+
+	ring.slots     = slots;
+	ring.slots_num = num;
+
+	return &ring.slots[fd];
+}
+
+/* a slot of a registered fd, no growing for the data path */
+static uring_slot_t *uring_slot_find(int fd)
+{
+	if (ring.fd < 0 || fd < 0 || (size_t)fd >= ring.slots_num)
+		return NULL;
+
+	return &ring.slots[fd];
+}
+
+static uint64_t uring_data(uint64_t kind, uint32_t gen, int fd)
+{
+	return kind | ((uint64_t)(gen & URING_GEN_MASK) << 32) | (uint32_t)fd;
+}
+
+static uint64_t uring_ms_data(int fd, uring_slot_t *slot)
+{
+	return uring_data((slot->listener) ? URING_KIND_ACCEPT : URING_KIND_RECV, slot->mgen, fd);
+}
+
+/* the multishot request takes EPOLLIN over, EOF comes with the recv: a short read says nothing */
+static uint32_t uring_poll_mask(uring_slot_t *slot)
+{
+	uint32_t mask = slot->events & ~(EPOLLONESHOT | EPOLLEXCLUSIVE);
+
+	if (URING_MS_OFF != slot->ms)
+		mask &= ~EPOLLRDHUP;
+
+	if (URING_MS_OFF != slot->ms && URING_MS_POLL != slot->ms)
+		mask &= ~EPOLLIN;
+
+	return mask;
+}
+
+static int uring_arm_poll(int fd, uring_slot_t *slot, int multishot)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe();
+	if (!sqe)
+		return -1;
+
+	slot->gen++;
+	slot->mask = uring_poll_mask(slot);
+
+	sqe->opcode        = IORING_OP_POLL_ADD;
+	sqe->fd            = fd;
+	sqe->poll32_events = URING_POLL_MASK(slot->mask & ~EPOLLET);
+	sqe->len           = (multishot) ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data     = uring_data(URING_KIND_POLL, slot->gen, fd);
+
+	slot->armed = 1;
+	slot->quiet = (multishot && !(slot->events & EPOLLET));
+
+	return 0;
+}
+
+static int uring_arm(int fd, uring_slot_t *slot)
+{
+	return uring_arm_poll(fd, slot, slot->events & EPOLLET);
+}
+
+static int uring_disarm(int fd, uring_slot_t *slot)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if (!slot->armed)
+		return 0;
+
+	sqe = uring_get_sqe();
+	if (!sqe)
+		return -1;
+
+	sqe->opcode    = IORING_OP_POLL_REMOVE;
+	sqe->fd        = -1;
+	sqe->addr      = uring_data(URING_KIND_POLL, slot->gen, fd);
+	sqe->user_data = URING_IGNORE;
+
+	/* whatever the old request still completes with is stale now */
+	slot->gen++;
+	slot->armed = 0;
+
+	return 0;
+}
+
+/* poll request for the current interest and multishot state */
+static int uring_sync(int fd, uring_slot_t *slot)
+{
+	if (slot->armed && slot->mask == uring_poll_mask(slot))
+		return 0;
+
+	if (uring_disarm(fd, slot) < 0)
+		return -1;
+
+	return uring_arm(fd, slot);
+}
+
+static int uring_cancel(uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe();
+	if (!sqe)
+		return -1;
+
+	sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+	sqe->fd        = -1;
+	sqe->addr      = user_data;
+	sqe->user_data = URING_IGNORE;
+
+	return 0;
+}
+
+static int uring_slot_room(uring_slot_t *slot)
+{
+	return slot->held < ((slot->listener) ? URING_SLOT_FDS : URING_SLOT_BUFS);
+}
+
+/* an idle recv or accept goes out again while the slot is read and holds little */
+static void uring_ms_arm(int fd, uring_slot_t *slot)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if (URING_MS_IDLE != slot->ms || !(slot->events & EPOLLIN) || !uring_slot_room(slot))
+		return;
+
+	sqe = uring_get_sqe();
+	if (!sqe)
+		return;
+
+	slot->mgen++;
+
+	if (slot->listener) {
+		sqe->opcode       = IORING_OP_ACCEPT;
+		sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK;
+	} else {
+		sqe->opcode       = IORING_OP_RECV;
+		sqe->ioprio       = IORING_RECV_MULTISHOT;
+		sqe->flags        = IOSQE_BUFFER_SELECT;
+		sqe->buf_group    = URING_BUF_GROUP;
+	}
+
+	sqe->fd        = fd;
+	sqe->user_data = uring_ms_data(fd, slot);
+
+	slot->ms = URING_MS_ARMED;
+}
+
+/* level triggered data, fds and EOF are reported on every wait until read */
+static void uring_ready(int fd, uring_slot_t *slot)
+{
+	if (slot->ready)
+		return;
+
+	slot->ready = 1;
+	slot->next  = ring.ready;
+	ring.ready  = fd;
+}
+
+static void uring_ms_reset(int fd, uring_slot_t *slot)
+{
+	if (URING_MS_ARMED == slot->ms)
+		uring_cancel(uring_ms_data(fd, slot));
+
+	/* buffers and fds still in flight are recognized by the generation */
+	slot->mgen++;
+
+	while (slot->held) {
+		uint16_t head = slot->head;
+
+		if (slot->listener) {
+			slot->head = (head + 1) & (slot->fds_num - 1);
+			close(slot->fds[head]);
+		} else {
+			slot->head = ring.buf_next[head];
+			uring_buf_put(head);
+		}
+
+		slot->held--;
+	}
+
+	slot->off      = 0;
+	slot->ms       = URING_MS_OFF;
+	slot->ms_err   = 0;
+	slot->listener = 0;
+}
+
+static void uring_send_reset(uring_slot_t *slot)
+{
+	unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+	/* not submitted yet: its iovecs may point at memory about to go */
+	if (URING_SEND_QUEUED == slot->send && (int)(slot->send_pos - head) >= 0) {
+		struct io_uring_sqe *sqe = &ring.sqes[slot->send_pos & *ring.sq_mask];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode    = IORING_OP_NOP;
+		sqe->user_data = URING_IGNORE;
+	}
+
+	slot->sgen++;
+	slot->send   = URING_SEND_NONE;
+	slot->ringed = 0;
+}
+
+static void uring_slot_reset(int fd, uring_slot_t *slot)
+{
+	uring_ms_reset(fd, slot);
+	uring_send_reset(slot);
+}
+
+static int uring_mod(int fd, uint32_t events, void *data)
+{
+	uring_slot_t *slot = uring_slot(fd);
+	if (!slot)
+		return -1;
+
+	/* a new owner of the fd starts out with a poll of its own and plain io */
+	if (slot->data != data) {
+		uring_slot_reset(fd, slot);
+
+		if (uring_disarm(fd, slot) < 0)
+			return -1;
+	}
+
+	slot->data   = data;
+	slot->events = events;
+
+	uring_ms_arm(fd, slot);
+
+	return uring_sync(fd, slot);
+}
+
+static int uring_add(int fd, uint32_t events, void *data)
+{
+	return uring_mod(fd, events, data);
+}
+
+static int uring_del(int fd)
+{
+	uring_slot_t *slot = uring_slot(fd);
+	if (!slot)
+		return -1;
+
+	uring_slot_reset(fd, slot);
+
+	if (uring_disarm(fd, slot) < 0)
+		return -1;
+
+	slot->data   = NULL;
+	slot->events = 0;
+
+	return 0;
+}
+
+static int uring_ring_sock(int fd, int listener)
+{
+	uring_slot_t *slot = uring_slot(fd);
+	int cap = (listener) ? URING_CAP_ACCEPT : URING_CAP_RECV;
+
+	if (!slot || !slot->data)
+		return -1;
+
+	if (!listener && (ring.caps & URING_CAP_SEND)) {
+		if (!slot->sbuf)
+			slot->sbuf = sp_t_calloc(sizeof(uring_send_t), NULL, "_uring_send_t_");
+
+		slot->ringed = (slot->sbuf != NULL);
+	}
+
+	if (listener && (ring.caps & URING_CAP_ACCEPT) && !slot->fds) {
+		slot->fds     = sp_t_calloc(URING_SLOT_FDS * sizeof(int), NULL, "_uring_fds_");
+		slot->fds_num = URING_SLOT_FDS;
+	}
+
+	if (!(ring.caps & cap) || (listener && !slot->fds) || URING_MS_OFF != slot->ms)
+		return 0;
+
+	slot->listener = listener;
+	slot->ms       = URING_MS_IDLE;
+	uring_ms_arm(fd, slot);
+
+	return uring_sync(fd, slot);
+}
+
+static int uring_ring(int fd)
+{
+	return uring_ring_sock(fd, 0);
+}
+
+static int uring_ring_listener(int fd)
+{
+	return uring_ring_sock(fd, 1);
+}
+
+/* drained by readv() / accept4(): the multishot request takes over again */
+static void uring_ms_resume(int fd, uring_slot_t *slot)
+{
+	if (URING_MS_OFF == slot->ms)
+		return;
+
+	slot->ms = URING_MS_IDLE;
+	uring_ms_arm(fd, slot);
+	uring_sync(fd, slot);
+}
+
+static ssize_t uring_read(int fd, const struct iovec *iov, int cnt)
+{
+	uring_slot_t *slot = uring_slot_find(fd);
+	size_t done = 0;
+	size_t pos  = 0;
+	ssize_t n = 0;
+	int i = 0;
+
+	if (!slot || (URING_MS_OFF == slot->ms && !slot->held)) {
+		STATS_INC(reads);
+		return readv(fd, iov, cnt);
+	}
+
+	while (i < cnt && slot->held) {
+		uint16_t bid = slot->head;
+		size_t   len = ring.buf_len[bid] - slot->off;
+
+		if (len > iov[i].iov_len - pos)
+			len = iov[i].iov_len - pos;
+
+		memcpy((char*)iov[i].iov_base + pos, ring.bufs + (size_t)bid * URING_BUF_SIZE + slot->off, len);
+
+		done      += len;
+		pos       += len;
+		slot->off += len;
+
+		if (slot->off == ring.buf_len[bid]) {
+			slot->head = ring.buf_next[bid];
+			slot->off  = 0;
+			slot->held--;
+			uring_buf_put(bid);
+		}
+
+		if (pos == iov[i].iov_len) {
+			pos = 0;
+			i++;
+		}
+	}
+
+	if (done) {
+		uring_ms_arm(fd, slot);
+		return (ssize_t)done;
+	}
+
+	switch (slot->ms) {
+		case URING_MS_DONE:
+			if (!slot->ms_err)
+				return 0;
+
+			errno = slot->ms_err;
+			return -1;
+
+		case URING_MS_ARMED:
+		case URING_MS_CANCEL:
+			/* the socket is the recv's until it completes */
+			errno = EAGAIN;
+			return -1;
+
+		default:
+			STATS_INC(reads);
+			n = readv(fd, iov, cnt);
+
+			if (n < 0 && EAGAIN == errno) {
+				uring_ms_resume(fd, slot);
+				errno = EAGAIN;
+			}
+
+			return n;
+	}
+}
+
+static int uring_accept(int fd, struct sockaddr *addr, socklen_t *len)
+{
+	uring_slot_t *slot = uring_slot_find(fd);
+	int in_fd = -1;
+
+	if (!slot || !slot->listener || (URING_MS_OFF == slot->ms && !slot->held))
+		return accept4(fd, addr, len, SOCK_NONBLOCK);
+
+	if (slot->held) {
+		in_fd = slot->fds[slot->head];
+
+		slot->head = (slot->head + 1) & (slot->fds_num - 1);
+		slot->held--;
+
+		uring_ms_arm(fd, slot);
+
+		/* the address is asked for only when it is needed */
+		if (addr && getpeername(in_fd, addr, len) < 0)
+			memset(addr, 0, *len);
+
+		return in_fd;
+	}
+
+	if (URING_MS_ARMED == slot->ms || URING_MS_CANCEL == slot->ms) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	in_fd = accept4(fd, addr, len, SOCK_NONBLOCK);
+	if (in_fd < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+		uring_ms_resume(fd, slot);
+		errno = EAGAIN;
+	}
+
+	return in_fd;
+}
+
+static ssize_t uring_send(int fd, const struct msghdr *msg, int flags)
+{
+	uring_slot_t *slot = uring_slot_find(fd);
+	struct io_uring_sqe *sqe = NULL;
+	size_t cnt = 0;
+
+	if (!slot || !slot->ringed) {
+		STATS_INC(writes);
+		return sendmsg(fd, msg, flags);
+	}
+
+	if (URING_SEND_NONE != slot->send) {
+		errno = EALREADY;
+		return -1;
+	}
+
+	sqe = uring_get_sqe();
+	if (!sqe) {
+		STATS_INC(writes);
+		return sendmsg(fd, msg, flags);
+	}
+
+	cnt = msg->msg_iovlen;
+	if (cnt > URING_SEND_IOV) {
+		cnt = URING_SEND_IOV;
+		flags |= MSG_MORE;
+	}
+
+	memset(&slot->sbuf->msg, 0, sizeof(slot->sbuf->msg));
+	memcpy(slot->sbuf->iov, msg->msg_iov, cnt * sizeof(struct iovec));
+	slot->sbuf->msg.msg_iov    = slot->sbuf->iov;
+	slot->sbuf->msg.msg_iovlen = cnt;
+
+	slot->sgen++;
+	slot->send     = URING_SEND_QUEUED;
+	slot->send_pos = ring.sq_local_tail - 1;
+
+	/* MSG_DONTWAIT: EAGAIN completes at once instead of arming a poll of its own */
+	sqe->opcode    = IORING_OP_SENDMSG;
+	sqe->fd        = fd;
+	sqe->addr      = (uint64_t)(uintptr_t)&slot->sbuf->msg;
+	sqe->len       = 1;
+	sqe->msg_flags = (uint32_t)(flags | MSG_DONTWAIT);
+	sqe->user_data = uring_data(URING_KIND_SEND, slot->sgen, fd);
+
+	STATS_INC(uring_sends);
+
+	return 0;
+}
+
+static ssize_t uring_send_done(int fd)
+{
+	uring_slot_t *slot = uring_slot_find(fd);
+
+	if (!slot || URING_SEND_NONE == slot->send)
+		return 0;
+
+	if (URING_SEND_QUEUED == slot->send) {
+		errno = EALREADY;
+		return -1;
+	}
+
+	slot->send = URING_SEND_NONE;
+
+	if (slot->send_res < 0) {
+		errno = -slot->send_res;
+		return -1;
+	}
+
+	return slot->send_res;
+}
+
+static int uring_close(int fd)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if (ring.fd < 0 || !(ring.caps & URING_CAP_CLOSE) || !(sqe = uring_get_sqe()))
+		return close(fd);
+
+	sqe->opcode    = IORING_OP_CLOSE;
+	sqe->fd        = fd;
+	sqe->user_data = URING_IGNORE;
+
+	return 0;
+}
+
+/* one event per slot and wait, later reports of the same slot add to it */
+static void uring_report(uring_slot_t *slot, uint32_t mask, struct epoll_event *events, int *n)
+{
+	if (slot->seq == ring.seq) {
+		events[slot->idx].events |= mask;
+		return;
+	}
+
+	slot->seq = ring.seq;
+	slot->idx = *n;
+
+	events[*n].events   = mask;
+	events[*n].data.ptr = slot->data;
+	(*n)++;
+}
+
+/*
+ * The accept takes the whole backlog at once, way more than it would
+ * be cancelled at: the ring of fds grows, a client is never dropped.
+ */
+static int uring_fds_push(uring_slot_t *slot, int fd)
+{
+	if ((uint32_t)slot->held == slot->fds_num) {
+		int *fds = sp_t_calloc(slot->fds_num * 2 * sizeof(int), NULL, "_uring_fds_");
+		uint32_t i = 0;
+
+		if (!fds)
+			return -1;
+
+		for (i = 0; i < slot->fds_num; i++)
+			fds[i] = slot->fds[(slot->head + i) & (slot->fds_num - 1)];
+
+		sp_free(slot->fds);
+
+		slot->fds      = fds;
+		slot->fds_num *= 2;
+		slot->head     = 0;
+	}
+
+	slot->fds[(slot->head + slot->held) & (slot->fds_num - 1)] = fd;
+	slot->held++;
+
+	return 0;
+}
+
+/* a received buffer or an accepted fd, 1 - the slot holds it now */
+static int uring_ms_take(int fd, uring_slot_t *slot, struct io_uring_cqe *cqe, int accept, int stale)
+{
+	uint16_t bid = 0;
+
+	if (accept) {
+		if (cqe->res < 0)
+			return 0;
+
+		/* a listener gone or out of memory: the client goes */
+		if (stale || uring_fds_push(slot, cqe->res) < 0) {
+			LOGGER_DBG( "accepted fd {%d} of listener {%d} has no place, closing\n", cqe->res, fd);
+			close(cqe->res);
+			return 0;
+		}
+
+		STATS_INC(uring_accepts);
+		return 1;
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_BUFFER))
+		return 0;
+
+	bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+	if (stale || cqe->res <= 0) {
+		uring_buf_put(bid);
+		return 0;
+	}
+
+	ring.buf_len[bid] = (uint32_t)cqe->res;
+
+	if (slot->held)
+		ring.buf_next[slot->tail] = bid;
+	else
+		slot->head = bid;
+
+	slot->tail = bid;
+	slot->held++;
+
+	STATS_INC(uring_recvs);
+	return 1;
+}
+
+static void uring_ms_complete(int fd, uring_slot_t *slot, struct io_uring_cqe *cqe,
+                              struct epoll_event *events, int *n)
+{
+	int accept = (URING_KIND_ACCEPT == (cqe->user_data & URING_KIND_MASK));
+	int stale  = (slot->mgen & URING_GEN_MASK) != ((uint32_t)(cqe->user_data >> 32) & URING_GEN_MASK) ||
+	             !slot->data || URING_MS_OFF == slot->ms;
+	int data   = uring_ms_take(fd, slot, cqe, accept, stale);
+
+	if (stale)
+		return;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		if (-EINVAL == cqe->res) {
+			LOGGER_DBG( "multishot %s is not supported, fd {%d}\n", (slot->listener) ? "accept" : "recv", fd);
+			ring.caps &= (slot->listener) ? ~URING_CAP_ACCEPT : ~URING_CAP_RECV;
+			slot->ms = URING_MS_OFF;
+		} else if (!slot->listener && !cqe->res) {
+			slot->ms = URING_MS_DONE;
+		} else if (cqe->res < 0 && -ECANCELED != cqe->res && (slot->listener || -ENOBUFS == cqe->res)) {
+			/* out of buffers, or an accept error like EMFILE: the syscall goes on from here */
+			LOGGER_DBG( "multishot request of fd {%d} has ended: %s, polling for now\n", fd, strerror(-cqe->res));
+			slot->ms = URING_MS_POLL;
+		} else if (cqe->res < 0 && -ECANCELED != cqe->res) {
+			slot->ms     = URING_MS_DONE;
+			slot->ms_err = -cqe->res;
+		} else {
+			slot->ms = URING_MS_IDLE;
+			uring_ms_arm(fd, slot);
+		}
+	} else if (URING_MS_ARMED == slot->ms && !uring_slot_room(slot)) {
+		/* enough waits in userspace, the rest stays in the kernel */
+		if (!uring_cancel(uring_ms_data(fd, slot)))
+			slot->ms = URING_MS_CANCEL;
+	}
+
+	if (data || URING_MS_DONE == slot->ms) {
+		uring_ready(fd, slot);
+
+		if (slot->events & EPOLLIN)
+			uring_report(slot, EPOLLIN, events, n);
+	}
+
+	uring_sync(fd, slot);
+}
+
+static void uring_send_complete(uring_slot_t *slot, struct io_uring_cqe *cqe,
+                                struct epoll_event *events, int *n)
+{
+	if ((slot->sgen & URING_GEN_MASK) != ((uint32_t)(cqe->user_data >> 32) & URING_GEN_MASK) ||
+	    !slot->data || URING_SEND_QUEUED != slot->send)
+		return;
+
+	slot->send     = URING_SEND_DONE;
+	slot->send_res = cqe->res;
+
+	/* whatever the interest, the owner has to collect the result */
+	uring_report(slot, EPOLLOUT, events, n);
+}
+
+/* level triggered slots with data, fds or EOF still waiting to be read */
+static void uring_wait_ready(struct epoll_event *events, int max, int *n)
+{
+	int *link = &ring.ready;
+
+	while (*link >= 0 && *n < max) {
+		int fd = *link;
+		uring_slot_t *slot = &ring.slots[fd];
+
+		if (!slot->held && URING_MS_DONE != slot->ms) {
+			*link = slot->next;
+			slot->ready = 0;
+			continue;
+		}
+
+		if (slot->data && (slot->events & EPOLLIN) && !(slot->events & EPOLLET))
+			uring_report(slot, EPOLLIN, events, n);
+
+		link = &slot->next;
+	}
+}
+
+static int uring_wait(struct epoll_event *events, int max, int timeout)
+{
+	unsigned head = 0;
+	unsigned tail = 0;
+	int n = 0;
+
+	/* 0 is what a fresh slot has seen */
+	if (!++ring.seq)
+		ring.seq++;
+
+	uring_wait_ready(events, max, &n);
+
+	if (uring_enter((n) ? 0 : 1, timeout) < 0)
+		return -1;
+
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail && n < max) {
+		struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+		uring_slot_t *slot = NULL;
+		uint32_t mask = 0;
+		int fd = (int)(uint32_t)cqe->user_data;
+
+		head++;
+
+		if (URING_IGNORE == cqe->user_data || (size_t)fd >= ring.slots_num)
+			continue;
+
+		slot = &ring.slots[fd];
+
+		switch (cqe->user_data & URING_KIND_MASK) {
+			case URING_KIND_RECV:
+			case URING_KIND_ACCEPT:
+				uring_ms_complete(fd, slot, cqe, events, &n);
+				continue;
+
+			case URING_KIND_SEND:
+				uring_send_complete(slot, cqe, events, &n);
+				continue;
+		}
+
+		if ((slot->gen & URING_GEN_MASK) != (uint32_t)(cqe->user_data >> 32) || !slot->data)
+			continue;
+
+		if (cqe->res < 0) {
+			LOGGER_DBG( "poll request for fd {%d} failed: %s\n", fd, strerror(-cqe->res));
+			slot->armed = 0;
+			continue;
+		}
+
+		/*
+		 * Unlike epoll, io_uring poll always reports EPOLLRDHUP. Nothing
+		 * the caller asked for is ready, so park a level triggered slot
+		 * on a multishot poll to wait for the next wakeup instead of
+		 * re-arming a oneshot that would complete again right away.
+		 */
+		mask = (uint32_t)cqe->res & ((slot->mask & ~EPOLLET) | EPOLLERR | EPOLLHUP);
+		if (!mask) {
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				slot->armed = 0;
+				uring_arm_poll(fd, slot, 1);
+			}
+			continue;
+		}
+
+		/* writable after a send ran into EAGAIN: the next one may go, an edge is not lost */
+		if ((mask & EPOLLOUT) && URING_SEND_DONE == slot->send && -EAGAIN == slot->send_res)
+			slot->send_res = 0;
+
+		uring_report(slot, mask, events, &n);
+
+		if (!(cqe->flags & IORING_CQE_F_MORE)) {
+			/* oneshot poll (or a multishot one the kernel gave up on) must be re-armed */
+			slot->armed = 0;
+			uring_arm(fd, slot);
+		} else if (slot->quiet) {
+			/* back to a oneshot poll, so readiness keeps being reported */
+			uring_disarm(fd, slot);
+			uring_arm(fd, slot);
+		}
+	}
+
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static const io_ops_t uring_ops = {
+	.name   = "io_uring",
+	.init   = uring_init,
+	.add    = uring_add,
+	.mod    = uring_mod,
+	.del    = uring_del,
+	.ring   = uring_ring,
+	.listen = uring_ring_listener,
+	.read   = uring_read,
+	.accept = uring_accept,
+	.send   = uring_send,
+	.sent   = uring_send_done,
+	.close  = uring_close,
+	.wait   = uring_wait,
+	.done   = uring_done,
+};
+
+const io_ops_t *io_uring_ops(void)
+{
+	return &uring_ops;
+}
@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include "listener.h"
@@ -25,14 +26,28 @@ static void __listener_destroy(void *ptr)
 	if (!obj)
 		return;
 
-	if (obj->fd)
+	if (obj->fd >= 0)
 		close(obj->fd);
 }
 
-listener_t *listener_create(unsigned short port)
+static int __listener_options(int fd, int defer_accept, int fastopen)
+{
+	if (defer_accept > 0 &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept, sizeof(defer_accept)) < 0)
+		return -1;
+
+	if (fastopen > 0 &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &fastopen, sizeof(fastopen)) < 0)
+		return -1;
+
+	return 0;
+}
+
+listener_t *listener_create(unsigned short port, int defer_accept, int fastopen)
 {
 	listener_t *rc = NULL;
 	struct sockaddr_in listen_addr;
+	int enable = 1;
 
 	do {
 		if (!port)
@@ -49,6 +64,10 @@ listener_t *listener_create(unsigned short port)
 		if (configure_socket(rc->fd) < 0)
 			break;
 
+		/* every worker binds its own listener to the same port */
+		if (setsockopt(rc->fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+			break;
+
 		memset(&listen_addr,0,sizeof(listen_addr));
 		listen_addr.sin_family = AF_INET;
 		listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -57,9 +76,14 @@ listener_t *listener_create(unsigned short port)
 		if (bind(rc->fd,(struct sockaddr*)&listen_addr,sizeof(listen_addr)) < 0)
 			break;
 
+		if (__listener_options(rc->fd, defer_accept, fastopen) < 0)
+			break;
+
 		if (listen(rc->fd, 100) < 0)
 			break;
 
+		rc->port = port;
+
 		return rc;
 	} while(0);
 
@@ -68,3 +92,24 @@ listener_t *listener_create(unsigned short port)
 
 	return NULL;
 }
+
+listener_t *listener_adopt(int fd, unsigned short port, int defer_accept, int fastopen)
+{
+	listener_t *rc = sp_t_calloc(sizeof(listener_t), __listener_destroy, "listener_t");
+
+	if (!rc) {
+		close(fd);
+		return NULL;
+	}
+
+	rc->fd   = fd;
+	rc->port = port;
+
+	/* the options of this binary win, the socket keeps its place in the reuseport group */
+	if (__listener_options(rc->fd, defer_accept, fastopen) < 0) {
+		sp_free(rc);
+		return NULL;
+	}
+
+	return rc;
+}
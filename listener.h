@@ -11,8 +11,17 @@
 typedef struct listener_type
 {
 	int fd;
+	unsigned short port;	//!< picks the tuning profile of the bridges it accepts
 } listener_t;
 
-listener_t *listener_create(unsigned short port);
+/*
+ * defer_accept: TCP_DEFER_ACCEPT seconds, accept() waits for the first
+ * data or for the timeout, 0 - off
+ * fastopen: TCP_FASTOPEN queue length, the SYN may carry data, 0 - off
+ */
+listener_t *listener_create(unsigned short port, int defer_accept, int fastopen);
+
+/* a listening socket handed over on upgrade, the options are set again; fd is ours even on failure */
+listener_t *listener_adopt(int fd, unsigned short port, int defer_accept, int fastopen);
 
 #endif /* LISTENER_H_ */
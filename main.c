@@ -11,14 +11,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/epoll.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 
 #include "logger.h"
 #include "sp.h"
@@ -26,10 +32,30 @@
 #include "socket_context.h"
 #include "listener.h"
 #include "bridge.h"
-#include "hashmap.h"
+#include "config.h"
+#include "stats.h"
+#include "buf_pool.h"
+#include "budget.h"
+#include "sockmap.h"
+#include "socket_utils.h"
+#include "ratelimit.h"
+#include "health.h"
+#include "affinity.h"
+#include "upgrade.h"
+
+/* bridge lists are private to the worker thread that owns them */
+__thread ctx_list_t *list_active   = NULL;
+__thread ctx_list_t *list_stopping = NULL;
+
+typedef struct worker_type
+{
+	int id;
+	pthread_t thread;
+	int started;
+	listener_t *listeners[MAX_LISTENERS];	//!< created by main in worker order, freed by main once the worker is gone
+} worker_t;
 
-map_t *map_active   = NULL;
-map_t *map_stopping = NULL;
+static int workers_alive = 0;
 
 // I/O type
 #define READ_IO  1
@@ -39,6 +65,38 @@ map_t *map_stopping = NULL;
 #define ENABLE_IO  1
 #define DISABLE_IO 2
 
+#define EDGE_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+static socket_ctx_t *bridge_socket(ctx_t *ctx)
+{
+	bridge_t *br = (bridge_t*)ctx->data;
+
+	return (BRIDGE_CLI_CTX == ctx->type) ? &br->cli : &br->srv;
+}
+
+/*
+ * Edge triggered mode: the socket is registered once for every event
+ * and read/write interest lives in userspace only, so no epoll_ctl()
+ * is issued when backpressure flips the interest.
+ */
+static int bridge_mod_io_edge(ctx_t *ctx, socket_ctx_t *sock, int io_type, int io_op)
+{
+	if (!sock->registered) {
+		if (io_add_sock(sock->fd, EDGE_EVENTS, (void*)ctx) < 0)
+			return -1;
+
+		sock->registered = 1;
+	}
+
+	if (READ_IO == io_type)
+		sock->read_state  = (ENABLE_IO == io_op) ? IO_ENABLED : IO_DISABLED;
+
+	if (WRITE_IO == io_type)
+		sock->write_state = (ENABLE_IO == io_op) ? IO_ENABLED : IO_DISABLED;
+
+	return 0;
+}
+
 static int bridge_mod_io(ctx_t *ctx, int io_type, int io_op)
 {
 	uint32_t events = 0;
@@ -49,6 +107,9 @@ static int bridge_mod_io(ctx_t *ctx, int io_type, int io_op)
 	bridge_t *br = (bridge_t*)ctx->data;
 	socket_ctx_t *sock = (BRIDGE_CLI_CTX == ctx->type) ? &br->cli : &br->srv;
 
+	if (config.edge_triggered)
+		return bridge_mod_io_edge(ctx, sock, io_type, io_op);
+
 	do {
 		// READ_IO
 		if (READ_IO == io_type) {
@@ -108,6 +169,21 @@ static void activate_bridge(ctx_t *cli_ctx, ctx_t *srv_ctx)
 	return;
 }
 
+/*
+ * Bridge reads may come out of the backend's buffers and writes go
+ * through its ring from now on. Not for splice, sockmap or a process
+ * that can be upgraded: their data has to stay in the socket for the
+ * pipe, the kernel or the next binary.
+ */
+static void bridge_ring(bridge_t *bridge)
+{
+	if (bridge->splice || config.sockmap || config.upgrade)
+		return;
+
+	io_ring_sock(bridge->cli.fd);
+	io_ring_sock(bridge->srv.fd);
+}
+
 static void deactivate_bridge_context(ctx_t *ctx)
 {
 	bridge_t *bridge = NULL;
@@ -122,6 +198,11 @@ static void deactivate_bridge_context(ctx_t *ctx)
 		if (!bridge)
 			break;
 
+		/* the timers point at srv ctx, or cli ctx of a lazy bridge, they must not outlive either side */
+		io_timer_cancel(&bridge->timer);
+		io_timer_cancel(&bridge->autosize);
+		io_timer_cancel(&bridge->drain);
+
 		bridge_mod_io(ctx, READ_IO,  DISABLE_IO);
 		bridge_mod_io(ctx, WRITE_IO, DISABLE_IO);
 		io_del_sock(ctx->fd);
@@ -143,8 +224,8 @@ static int deactivate_listener(ctx_t *ctx)
 		if (!listener)
 			break;
 
+		/* main closes it with the listener, an upgrade may hand it over until then */
 		io_del_sock(listener->fd);
-		close(listener->fd);
 	} while(0);
 
 	return rc;
@@ -156,52 +237,376 @@ static void destroy_context_cb(void *ptr)
 		return;
 
 	ctx_t *ctx = (ctx_t*)ptr;
+
+	io_loop_forget(ctx);
+
 	if (BRIDGE_CLI_CTX == ctx->type || BRIDGE_SRV_CTX == ctx->type)
 		deactivate_bridge_context(ctx);
 	else if (LISTEN_CTX == ctx->type)
 		deactivate_listener(ctx);
 }
 
-static void handle_io_listener(uint32_t events, ctx_t *ctx)
+/* upstream connect outcome for the destination health */
+static void bridge_connect_done(bridge_t *bridge, int ok)
 {
-	int in_fd = -1;
-	int err   = 1;
-	bridge_t *bridge         = NULL;
-	ctx_t    *bridge_srv_ctx = NULL;
+	health_result(&bridge->srv.sa, ok, (uint32_t)(io_loop_now() - bridge->connect_start));
+}
 
-	struct sockaddr_in cli_addr;
-	socklen_t cli_addr_len = sizeof(cli_addr);
+/*
+ * The upstream has not answered within --connect-timeout. A fastopen
+ * bridge is ACTIVE or even STOPPING by then, its SYN is still unanswered.
+ */
+static void bridge_connect_timeout(bridge_t *bridge, ctx_t *srv_ctx, ctx_t *cli_ctx)
+{
+	ctx_list_t *list = (BRIDGE_STOPPING == bridge->state) ? list_stopping : list_active;
 
-	do {
-		LOGGER_DBG( "handle_io_listener: events {%"PRIu32"} fd {%d} data {%p}\n", events, ctx->fd, ctx->data);
+	LOGGER_DBG( "bridge {%p} connect timeout\n", bridge);
 
-		in_fd = accept4(ctx->fd, (struct sockaddr *)&cli_addr, &cli_addr_len, SOCK_NONBLOCK);
-		if (in_fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
-			return;
+	STATS_INC(connect_timeouts);
+	STATS_INC(connect_failed);
+	bridge_connect_done(bridge, 0);
 
-		bridge = bridge_create(in_fd);
-		if (!bridge)
+	if (BRIDGE_STOPPING == bridge->state)
+		STATS_DEC(stopping);
+	else
+		STATS_DEC(active);
+
+	bridge->abort = 1;
+	bridge_set_state(bridge, BRIDGE_STOPPED);
+	context_list_remove(list, srv_ctx);
+	if (cli_ctx)
+		context_list_remove(list, cli_ctx);
+}
+
+static void bridge_timeout(tw_timer_t *timer, void *arg)
+{
+	ctx_t    *srv_ctx = (ctx_t*)arg;
+	ctx_t    *cli_ctx = srv_ctx->peer;
+	bridge_t *bridge  = (bridge_t*)srv_ctx->data;
+	uint64_t  idle    = 0;
+	uint64_t  limit   = 0;
+
+	switch (bridge->state) {
+		case BRIDGE_CONNECTING:
+			bridge_connect_timeout(bridge, srv_ctx, cli_ctx);
+			break;
+		case BRIDGE_ACTIVE:
+		case BRIDGE_STOPPING:
+			/* fastopen: the client did not speak first, the server may */
+			if (bridge->fastopen) {
+				if (bridge_fastopen_check(bridge))
+					bridge_connect_done(bridge, 1);
+				if (bridge->fastopen) {
+					/* the handshake is still not over: the connect timeout counts from connect() */
+					idle  = io_loop_now() - bridge->connect_start;
+					limit = (uint64_t)config.connect_timeout * 1000;
+					if (limit && idle >= limit) {
+						bridge_connect_timeout(bridge, srv_ctx, cli_ctx);
+						break;
+					}
+
+					bridge_fastopen_syn(bridge);
+					io_timer_arm(timer, (limit && limit - idle < FASTOPEN_DEFER_MS) ? (uint32_t)(limit - idle) : FASTOPEN_DEFER_MS,
+					             bridge_timeout, arg);
+					break;
+				}
+			}
+
+			/*
+			 * last_io is bumped on every event, re-arm for the remainder instead of on each io.
+			 * A half closed bridge still forwards the open direction, it only times out idle.
+			 */
+			idle  = io_loop_now() - bridge->last_io;
+			limit = (uint64_t)((BRIDGE_ACTIVE == bridge->state) ? config.idle_timeout : config.stopping_timeout) * 1000;
+			if (!limit)
+				break;
+			if (bridge->sockmap > 0)
+				idle = bridge_sockmap_idle(bridge, idle);
+			if (idle < limit) {
+				io_timer_arm(timer, (uint32_t)(limit - idle), bridge_timeout, arg);
+				break;
+			}
+
+			bridge->abort = 1;
+
+			if (BRIDGE_ACTIVE == bridge->state) {
+				LOGGER_DBG( "bridge {%p} idle timeout\n", bridge);
+
+				STATS_INC(idle_timeouts);
+				STATS_DEC(active);
+
+				bridge_set_state(bridge, BRIDGE_STOPPED);
+				context_list_remove(list_active, cli_ctx);
+				context_list_remove(list_active, srv_ctx);
+			} else {
+				LOGGER_DBG( "bridge {%p} is staying in BRIDGE_STOPPING for too long, stop it\n", bridge);
+
+				STATS_INC(stopping_timeouts);
+				STATS_DEC(stopping);
+
+				bridge_set_state(bridge, BRIDGE_STOPPED);
+				context_list_remove(list_stopping, cli_ctx);
+				context_list_remove(list_stopping, srv_ctx);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static void bridge_autosize_timer(tw_timer_t *timer, void *arg)
+{
+	ctx_t    *srv_ctx = (ctx_t*)arg;
+	bridge_t *bridge  = (bridge_t*)srv_ctx->data;
+
+	if (BRIDGE_ACTIVE != bridge->state && BRIDGE_STOPPING != bridge->state)
+		return;
+
+	/* no userspace queues to size once the kernel forwards the bridge */
+	if (bridge->sockmap > 0)
+		return;
+
+	bridge_autosize(bridge, config.queue_min, config.queue_max, config.autosize_sockbuf);
+	io_timer_arm(timer, (uint32_t)config.autosize, bridge_autosize_timer, arg);
+}
+
+/*
+ * sockmap mode: when EOF is read, data the kernel redirected may still
+ * wait in the psock backlog of the peer and a shutdown() right away
+ * would cut it off. The FIN waits for the send queue to stay empty, the
+ * bridge is dropped once both FINs are out.
+ */
+static void bridge_sockmap_drain_timer(tw_timer_t *timer, void *arg)
+{
+	ctx_t    *srv_ctx = (ctx_t*)arg;
+	ctx_t    *cli_ctx = srv_ctx->peer;
+	bridge_t *bridge  = (bridge_t*)srv_ctx->data;
+	int pending = 0;
+
+	if (BRIDGE_STOPPING != bridge->state)
+		return;
+
+	pending += bridge_sockmap_drain(&bridge->cli);
+	pending += bridge_sockmap_drain(&bridge->srv);
+
+	if (pending) {
+		io_timer_arm(timer, SOCKMAP_DRAIN_MS, bridge_sockmap_drain_timer, arg);
+		return;
+	}
+
+	if (!bridge->cli.shut || !bridge->srv.shut)
+		return;
+
+	LOGGER_DBG( "bridge {%p} has been drained by the kernel\n", bridge);
+
+	STATS_DEC(stopping);
+
+	bridge_set_state(bridge, BRIDGE_STOPPED);
+	context_list_remove(list_stopping, cli_ctx);
+	context_list_remove(list_stopping, srv_ctx);
+}
+
+static void bridge_sockmap_shutdown(bridge_t *bridge, socket_ctx_t *sock, ctx_t *srv_ctx)
+{
+	sock->shut_wait  = 1;
+	sock->drain_idle = 0;
+
+	if (!bridge->drain.armed)
+		io_timer_arm(&bridge->drain, SOCKMAP_DRAIN_MS, bridge_sockmap_drain_timer, srv_ctx);
+}
+
+/* direction src -> dst: done once src has seen EOF and dst has nothing left to send */
+static void bridge_direction_done(bridge_t *bridge, socket_ctx_t *src, socket_ctx_t *dst, ctx_t *srv_ctx)
+{
+	if (!src->eof || dst->shut || dst->shut_wait || !socket_out_is_empty(dst))
+		return;
+
+	if (bridge->sockmap > 0)
+		bridge_sockmap_shutdown(bridge, dst, srv_ctx);
+	else
+		bridge_shutdown(dst);
+}
+
+/* (re)arm the bridge timer for its current state, srv_ctx is there from BRIDGE_CONNECTING on */
+static void bridge_arm_timer(bridge_t *bridge, ctx_t *srv_ctx)
+{
+	int timeout = 0;
+
+	/* until the SYN is out and answered, see bridge_timeout() */
+	if (bridge->fastopen && BRIDGE_CONNECTING != bridge->state) {
+		io_timer_arm(&bridge->timer, FASTOPEN_DEFER_MS, bridge_timeout, srv_ctx);
+		return;
+	}
+
+	switch (bridge->state) {
+		case BRIDGE_CONNECTING: timeout = config.connect_timeout;  break;
+		case BRIDGE_ACTIVE:     timeout = config.idle_timeout;     break;
+		case BRIDGE_STOPPING:   timeout = config.stopping_timeout; break;
+		default: break;
+	}
+
+	if (timeout > 0)
+		io_timer_arm(&bridge->timer, (uint32_t)timeout * 1000, bridge_timeout, srv_ctx);
+	else
+		io_timer_cancel(&bridge->timer);
+}
+
+/*
+ * Open the upstream and start connecting. cli_ctx is there for a lazy
+ * bridge only, its client has been heard from and waits for the connect.
+ */
+static int bridge_start(bridge_t *bridge, ctx_t *cli_ctx)
+{
+	ctx_t *bridge_srv_ctx = NULL;
+	int rc = -1;
+
+	do {
+		/* the destination is down, no use trying: RST to the client */
+		if (health_admit(&bridge->srv.sa) < 0) {
+			LOGGER_DBG( "bridge {%p} destination is down, reset\n", bridge);
+			STATS_INC(breaker_rejects);
+			bridge->abort = 1;
+			break;
+		}
+
+		if (bridge_upstream(bridge) < 0)
 			break;
 
 		bridge_srv_ctx = context_create(bridge->srv.fd, BRIDGE_SRV_CTX, bridge, destroy_context_cb);
 		if (!bridge_srv_ctx)
 			break;
 
-		if (bridge_connect(bridge) < 0)
+		bridge->connect_start = io_loop_now();
+		if (bridge_connect(bridge, config.fastopen) < 0) {
+			bridge_connect_done(bridge, 0);
 			break;
+		}
 
 		if (BRIDGE_CONNECTING != bridge->state)
 			break;
 
+		if (cli_ctx) {
+			bridge_mod_io(cli_ctx, READ_IO, DISABLE_IO);
+			context_set_peer(cli_ctx, bridge_srv_ctx);
+			context_set_peer(bridge_srv_ctx, cli_ctx);
+		}
+
 		bridge_mod_io(bridge_srv_ctx, WRITE_IO, ENABLE_IO);
-		hashmap_put2(map_active, NULL, bridge_srv_ctx);
+		context_list_put(list_active, bridge_srv_ctx);
+		bridge_arm_timer(bridge, bridge_srv_ctx);
+		STATS_INC(active);
 
-		err = 0;
+		rc = 0;
 	} while(0);
 
 	if (bridge_srv_ctx)
 		sp_free(bridge_srv_ctx);
 
+	return rc;
+}
+
+/* the lazy wait is over: the client has spoken or stayed silent for too long */
+static void bridge_lazy_start(bridge_t *bridge, ctx_t *cli_ctx)
+{
+	STATS_DEC(lazy);
+
+	if (bridge_start(bridge, cli_ctx) < 0) {
+		bridge->abort = 1;
+		bridge_set_state(bridge, BRIDGE_STOPPED);
+		context_list_remove(list_active, cli_ctx);
+	}
+}
+
+/* a client that speaks second has had its time, the server may speak first */
+static void bridge_lazy_timeout(tw_timer_t *timer, void *arg)
+{
+	ctx_t    *cli_ctx = (ctx_t*)arg;
+	bridge_t *bridge  = (bridge_t*)cli_ctx->data;
+
+	if (BRIDGE_NEW != bridge->state)
+		return;
+
+	LOGGER_DBG( "bridge {%p} client is silent, connecting anyway\n", bridge);
+	bridge_lazy_start(bridge, cli_ctx);
+}
+
+/* defer accept mode: only the client side exists until it sends something */
+static int bridge_lazy(bridge_t *bridge)
+{
+	ctx_t *bridge_cli_ctx = context_create(bridge->cli.fd, BRIDGE_CLI_CTX, bridge, destroy_context_cb);
+
+	if (!bridge_cli_ctx)
+		return -1;
+
+	bridge_mod_io(bridge_cli_ctx, READ_IO, ENABLE_IO);
+	context_list_put(list_active, bridge_cli_ctx);
+	io_timer_arm(&bridge->timer, (uint32_t)config.defer_accept * 1000, bridge_lazy_timeout, bridge_cli_ctx);
+	STATS_INC(lazy);
+
+	sp_free(bridge_cli_ctx);
+
+	return 0;
+}
+
+static void handle_io_listener(uint32_t events, ctx_t *ctx)
+{
+	int in_fd = -1;
+	int ready = 1;
+	bridge_t *bridge = NULL;
+	ratelimit_verdict_t verdict = RATELIMIT_PASS;
+
+	struct sockaddr_in cli_addr;
+	socklen_t cli_addr_len = sizeof(cli_addr);
+
+	do {
+		LOGGER_DBG( "handle_io_listener: events {%"PRIu32"} fd {%d} data {%p}\n", events, ctx->fd, ctx->data);
+
+		/* bridge_create() looks the client up anyway, the limiter needs it first */
+		memset(&cli_addr, 0, sizeof(cli_addr));
+		in_fd = io_accept_sock(ctx->fd, (ratelimit_enabled()) ? (struct sockaddr *)&cli_addr : NULL, &cli_addr_len);
+		if (in_fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		if (in_fd < 0)
+			break;
+
+		STATS_INC(accepted);
+
+		/* over the limit: RST right away, before any bridge state exists */
+		verdict = ratelimit_admit(cli_addr.sin_addr.s_addr);
+		if (RATELIMIT_PASS != verdict) {
+			LOGGER_DBG( "fd {%d} source is over its %s limit, reset\n", in_fd,
+			            (RATELIMIT_RATE == verdict) ? "rate" : "connection");
+
+			if (RATELIMIT_RATE == verdict) STATS_INC(limited_rate);
+			else                           STATS_INC(limited_conns);
+
+			socket_abort(in_fd);
+			break;
+		}
+
+		bridge = bridge_create(in_fd, config.ring_size, ((listener_t*)ctx->data)->port);
+		if (!bridge) {
+			ratelimit_release(cli_addr.sin_addr.s_addr);
+			break;
+		}
+
+		/* accept was deferred until data or a timeout, most clients have spoken by now */
+		if (config.defer_accept)
+			ready = socket_peek(in_fd);
+
+		if (!ready) {
+			LOGGER_DBG( "bridge {%p} client has closed without a byte\n", bridge);
+			STATS_INC(lazy_closed);
+			break;
+		}
+
+		if (ready < 0)
+			bridge_lazy(bridge);
+		else
+			bridge_start(bridge, NULL);
+	} while(0);
+
 	// unref bridge, it's still referenced by a context
 	if (bridge)
 		sp_free(bridge);
@@ -211,19 +616,54 @@ static void handle_io_listener(uint32_t events, ctx_t *ctx)
 	return;
 }
 
+/* lazy bridge, client side: data starts the upstream, EOF or an error drops the bridge */
+static void handle_io_bridge_new(uint32_t events, ctx_t *ctx)
+{
+	bridge_t *bridge = (bridge_t *)ctx->data;
+
+	switch (socket_peek(ctx->fd)) {
+		case 1:
+			bridge_lazy_start(bridge, ctx);
+			return;
+		case 0:
+			LOGGER_DBG( "bridge {%p} client has closed without a byte\n", bridge);
+			STATS_INC(lazy_closed);
+			break;
+		default:
+			if (EAGAIN == errno) {
+				bridge_socket(ctx)->readable = 0;
+				return;
+			}
+
+			bridge->abort = 1;
+			break;
+	}
+
+	STATS_DEC(lazy);
+
+	bridge_set_state(bridge, BRIDGE_STOPPED);
+	context_list_remove(list_active, ctx);
+}
+
 static void handle_io_bridge_connecting(uint32_t events, ctx_t *ctx)
 {
 	bridge_t *bridge = (bridge_t *)ctx->data;
 	ctx_t    *bridge_cli_ctx = NULL;
 	ctx_t    *bridge_srv_ctx = ctx;
+	ctx_t    *peer_ctx = ctx->peer;
 
 	struct sockaddr_in peer;
 	int err = 0;
 	int drop = 1;
+	int refused = (BRIDGE_SRV_CTX == ctx->type);
 	socklen_t len = 0;
 
+	/* a lazy bridge has its client side already, it only reports errors here */
+	if (BRIDGE_CLI_CTX == ctx->type && !(events & (EPOLLERR | EPOLLHUP)))
+		return;
+
 	do {
-		if ( !(events & EPOLLOUT) )
+		if ( !(events & EPOLLOUT) || BRIDGE_SRV_CTX != ctx->type )
 			break;
 
 		len = sizeof(err);
@@ -235,25 +675,52 @@ static void handle_io_bridge_connecting(uint32_t events, ctx_t *ctx)
 			break;
 		}
 
+		/* a deferred fastopen connect has no peer until the first write */
 		len = sizeof(peer);
-		if (getpeername(ctx->fd, (struct sockaddr *)&peer, &len) < 0) {
+		if (!bridge->fastopen && getpeername(ctx->fd, (struct sockaddr *)&peer, &len) < 0) {
 			LOGGER_DBG( "bridge {%p} failed to connect to srv: getpeername error\n", bridge);
 			break;
 		}
 
+		/* connected; a deferred fastopen SYN has not even left, see bridge_fastopen_check() */
+		refused = 0;
+		if (!bridge->fastopen)
+			bridge_connect_done(bridge, 1);
+
 		bridge_set_state(bridge, BRIDGE_ACTIVE);
 
-		bridge_cli_ctx = context_create(bridge->cli.fd, BRIDGE_CLI_CTX, bridge, destroy_context_cb);
+		if (config.splice && bridge_enable_splice(bridge) < 0)
+			LOGGER_DBG( "bridge {%p} has no pipes, falling back to queues\n", bridge);
+
+		/* a ring reuses its memory right away, pinned pages need node lists */
+		if (config.zerocopy && !bridge->splice && !bridge->ring_size) {
+			zc_enable(&bridge->cli.zc, bridge->cli.fd);
+			zc_enable(&bridge->srv.zc, bridge->srv.fd);
+		}
+
+		bridge_cli_ctx = (peer_ctx) ? sp_dup(peer_ctx) : context_create(bridge->cli.fd, BRIDGE_CLI_CTX, bridge, destroy_context_cb);
 		if (!bridge_cli_ctx)
 			break;
 
-		hashmap_put2(map_active, NULL, bridge_cli_ctx);
+		if (!peer_ctx)
+			context_list_put(list_active, bridge_cli_ctx);
 
 		context_set_peer(bridge_cli_ctx, bridge_srv_ctx);
 		context_set_peer(bridge_srv_ctx, bridge_cli_ctx);
 		activate_bridge(bridge_cli_ctx, bridge_srv_ctx);
+		bridge_ring(bridge);
+
+		if (config.sockmap)
+			bridge_sockmap(bridge);
 
 		LOGGER_DBG("bridge {%p} has been activated\n", bridge);
+		STATS_INC(connected);
+
+		bridge->last_io = io_loop_now();
+		bridge_arm_timer(bridge, bridge_srv_ctx);
+
+		if (config.autosize)
+			io_timer_arm(&bridge->autosize, (uint32_t)config.autosize, bridge_autosize_timer, bridge_srv_ctx);
 
 		drop = 0;
 	} while(0);
@@ -262,235 +729,410 @@ static void handle_io_bridge_connecting(uint32_t events, ctx_t *ctx)
 		sp_free(bridge_cli_ctx);
 
 	if (drop) {
-		bridge_set_state(bridge, BRIDGE_STOPPING);
-		hashmap_remove2(map_active, ctx);
+		STATS_INC(connect_failed);
+		STATS_DEC(active);
+
+		if (refused)
+			bridge_connect_done(bridge, 0);
+
+		bridge->abort = 1;
+		bridge_set_state(bridge, BRIDGE_STOPPED);
+		context_list_remove(list_active, ctx);
+		if (peer_ctx)
+			context_list_remove(list_active, peer_ctx);
 	}
 }
 
-static int context_flush_queue(ctx_t *ctx)
+/* splice mode: pipe -> socket, the kernel moves the pages without a copy */
+static int context_flush_pipe(ctx_t *ctx)
 {
-	int drop = 0;
+	socket_ctx_t *sock = bridge_socket(ctx);
+	pipe_t       *pipe = &sock->pipe;
 
-	bridge_t     *bridge = (bridge_t *)ctx->data;
-	send_queue_t *queue  = (BRIDGE_CLI_CTX == ctx->type) ? bridge->cli.queue : bridge->srv.queue;
+	while (pipe->len) {
+		STATS_INC(splices);
+		ssize_t n = splice(pipe->rfd, NULL, ctx->fd, NULL, pipe->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0) {
+			/* fastopen: the SYN went out without data, the rest follows the handshake */
+			if (EINPROGRESS == errno)
+				errno = EAGAIN;
 
-	while(1) {
-		int done = 0;
-		int n    = 0;
+			if (errno != EAGAIN && errno != EINTR) {
+				LOGGER_DBG( "splice error to fd {%d} ctx {%p}\n", ctx->fd, ctx);
+				return -1;
+			}
 
-		if (queue_is_empty(queue))
+			if (EAGAIN == errno)
+				sock->writable = 0;
 			break;
+		}
 
-		send_queue_node_t *node = queue_get_first(queue);
-		if (!node)
+		if (!n)
 			break;
 
-		n = write(ctx->fd, node->buf + node->drained, node->len - node->drained);
-		if (n < 0) {
+		pipe->len -= n;
+		pipe->full = 0;
+	}
+
+	return 0;
+}
+
+/* splice mode: socket -> peer's pipe, pipe fill level is the backpressure */
+static int context_splice_read(ctx_t *ctx, int *eof)
+{
+	bridge_t     *bridge = (bridge_t *)ctx->data;
+	socket_ctx_t *sock   = bridge_socket(ctx);
+	pipe_t       *pipe   = (BRIDGE_CLI_CTX == ctx->type) ? &bridge->srv.pipe : &bridge->cli.pipe;
+
+	/*
+	 * No rdhup short read shortcut here: splice also stops short when
+	 * the pipe runs out of buffers, the next call tells EOF for sure.
+	 */
+	while (pipe->len < pipe->size && !pipe->full) {
+		STATS_INC(splices);
+		ssize_t n = splice(ctx->fd, NULL, pipe->wfd, NULL, pipe->size - pipe->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (!n) {
+			LOGGER_DBG( "remote peer {%d} has closed its writing end, bridge {%p}\n", ctx->fd, bridge);
+			sock->readable = 0;
+			(*eof)++;
+			break;
+		} else if (n < 0) {
 			if (errno != EAGAIN && errno != EINTR) {
-				LOGGER_DBG( "write error to fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
-				drop++;
-			} else {
-				done++;
+				LOGGER_DBG( "splice error from fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
+				return -1;
+			}
+
+			/* either the socket is drained or the pipe is out of buffers before size */
+			if (EAGAIN == errno) {
+				if (pipe->len) pipe->full = 1;
+				else           sock->readable = 0;
 			}
-		} else {
-			node->drained += n;
-			if (node->drained == node->len)
-				queue_del_first(queue);
+			break;
 		}
 
-		if (node)
-			sp_free(node);
+		if (BRIDGE_CLI_CTX == ctx->type) STATS_ADD(bytes_cli, n);
+		else                             STATS_ADD(bytes_srv, n);
 
-		if (done)
-			break;
+		pipe->len += n;
 	}
 
-	if (drop)
-		return -1;
-
 	return 0;
 }
 
-static void adjust_io(bridge_t *br, ctx_t *cli_ctx, ctx_t *srv_ctx)
+static int context_flush_queue(ctx_t *ctx)
 {
-	LOGGER_DBG( "ctx {%p} bridge {%p} cli queue {%s} srv queue {%s}\n",
-	                 ctx, br,
-					 (queue_is_full(br->cli.queue)) ? "FULL" : "NOT FULL",
-					 (queue_is_full(br->cli.queue)) ? "FULL" : "NOT FULL");
+	int     drop = 0;
+	ssize_t n    = 0;
 
-	if (queue_is_full(br->cli.queue)) bridge_mod_io(srv_ctx, READ_IO, DISABLE_IO);
-	else                              bridge_mod_io(srv_ctx, READ_IO, ENABLE_IO);
+	bridge_t     *bridge = (bridge_t *)ctx->data;
+	send_queue_t *queue  = bridge_socket(ctx)->queue;
 
-	if (queue_is_full(br->srv.queue)) bridge_mod_io(cli_ctx, READ_IO, DISABLE_IO);
-	else                              bridge_mod_io(cli_ctx, READ_IO, ENABLE_IO);
+	struct iovec  iov[IOV_MAX];
+	struct msghdr msg;
 
-	if (queue_is_empty(br->cli.queue)) bridge_mod_io(cli_ctx, WRITE_IO, DISABLE_IO);
-	else                               bridge_mod_io(cli_ctx, WRITE_IO, ENABLE_IO);
+	if (bridge->splice)
+		return context_flush_pipe(ctx);
 
-	if (queue_is_empty(br->srv.queue)) bridge_mod_io(srv_ctx, WRITE_IO, DISABLE_IO);
-	else                               bridge_mod_io(srv_ctx, WRITE_IO, ENABLE_IO);
-}
+	/* a send handed to the ring earlier: what it took goes now, nothing else while it flies */
+	n = io_send_done(ctx->fd);
+	if (n < 0 && EALREADY == errno) {
+		bridge_socket(ctx)->writable = 0;
+		return 0;
+	}
 
-static void handle_io_bridge_active(uint32_t events, ctx_t *ctx)
-{
-	int drop = 0;
-	int eof  = 0;
+	while(1) {
+		int more = 0;
 
-	bridge_t     *bridge = (bridge_t *)ctx->data;
-	ctx_t        *peer   = ctx->peer;
-	send_queue_t *queue  = NULL;
+		if (!n) {
+			if (queue_is_empty(queue))
+				break;
 
-	if (events & EPOLLERR || events & EPOLLHUP) {
-		if (BRIDGE_CLI_CTX == ctx->type) LOGGER_DBG( "connection closed from cli fd {%d} bridge {%p}\n", ctx->fd, bridge);
-		if (BRIDGE_SRV_CTX == ctx->type) LOGGER_DBG( "connection closed from srv fd {%d} bridge {%p}\n", ctx->fd, bridge);
-		drop++;
-	}
+			/* a node once sent with MSG_ZEROCOPY stays on that path, its pages are pinned */
+			send_queue_node_t *node = queue_get_first(queue);
+			zc_t              *zc   = &bridge_socket(ctx)->zc;
+
+			if (zc->enabled && node && (node->zc_refs || node->len - node->drained >= config.zerocopy)) {
+				STATS_INC(writes);
+				if (zc_send(zc, ctx->fd, queue) < 0) {
+					if (EINPROGRESS == errno)
+						errno = EAGAIN;
+
+					if (errno != EAGAIN && errno != EINTR) {
+						LOGGER_DBG( "zerocopy send error to fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
+						drop++;
+					} else if (EAGAIN == errno) {
+						bridge_socket(ctx)->writable = 0;
+					}
+					break;
+				}
+				continue;
+			}
 
-	if (events & EPOLLIN) {
-		queue = (BRIDGE_CLI_CTX == ctx->type) ? bridge->srv.queue : bridge->cli.queue;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov    = iov;
+			msg.msg_iovlen = queue_fill_iov(queue, iov, IOV_MAX, &more);
+			if (!msg.msg_iovlen)
+				break;
 
-		while(1) {
-			char buf[QUEUE_SIZE];
-			ssize_t n = read(ctx->fd, buf, sizeof(buf));
+			/* nodes left out of this batch follow right away, let TCP build full segments */
+			n = io_send_sock(ctx->fd, &msg, MSG_NOSIGNAL | ((more) ? MSG_MORE : 0));
 			if (!n) {
-				LOGGER_DBG( "remote peer {%d} has closed its writing end, bridge {%p}\n", ctx->fd, bridge);
-				eof++;
+				/* on its way with the next wait, EPOLLOUT brings the result */
+				bridge_socket(ctx)->writable = 0;
 				break;
-			} else if (n < 0) {
-				if (errno == EAGAIN || errno == EINTR)
-					break;
+			}
+		}
 
-				LOGGER_DBG( "read error from fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
+		if (n < 0) {
+			/* fastopen: the SYN went out without data, the rest follows the handshake */
+			if (EINPROGRESS == errno)
+				errno = EAGAIN;
+
+			if (errno != EAGAIN && errno != EINTR) {
+				LOGGER_DBG( "write error to fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
 				drop++;
-			} else {
-				queue_enqueue(queue, buf, n);
-				if (queue_is_full(queue))
-					break;
+			} else if (EAGAIN == errno) {
+				bridge_socket(ctx)->writable = 0;
 			}
+			break;
 		}
-	}
 
-	if (events & EPOLLOUT) {
-		if (context_flush_queue(ctx) < 0)
-			drop++;
+		queue_drain(queue, n);
+		n = 0;
 	}
 
-	ctx_t *cli_ctx = (BRIDGE_CLI_CTX == ctx->type) ? ctx : ctx->peer;
-	ctx_t *srv_ctx = (BRIDGE_SRV_CTX == ctx->type) ? ctx : ctx->peer;
+	/* drained: an idle bridge keeps neither buffers nor queue headers */
+	bridge_queue_trim(bridge_socket(ctx));
 
-	adjust_io(bridge, cli_ctx, srv_ctx);
-
-	if (eof) {
-		socket_ctx_t *read_socket = (BRIDGE_CLI_CTX == ctx->type) ? &bridge->cli : &bridge->srv;
-		socket_ctx_t *peer_socket = (BRIDGE_CLI_CTX == ctx->type) ? &bridge->srv : &bridge->cli;
+	if (drop)
+		return -1;
 
-		// both queues are empty, close writing end
-		if (queue_is_empty(bridge->cli.queue) && queue_is_empty(bridge->srv.queue))
-			shutdown(peer_socket->fd, SHUT_WR);
+	return 0;
+}
 
-		LOGGER_DBG( "=== bridge {%p} ctx {%p <-> %s} EOF\n", bridge, ctx, type_str[ctx->type]);
+/*
+ * TCP_NOTSENT_LOWAT: sendmsg() stops at the low watermark, so a socket
+ * whose kernel already holds that much unsent data while more waits in
+ * its queue is backlogged. Reads feeding it pause right there instead of
+ * filling the queue up, the data waits in one place only.
+ */
+static int socket_backlogged(bridge_t *br, socket_ctx_t *sock)
+{
+	if (!br->profile || br->profile->notsent_lowat <= 0)
+		return 0;
 
-		read_socket->eof++;
+	return sock->unsent >= br->profile->notsent_lowat && !socket_out_is_empty(sock);
+}
 
-		/* Stop reading from socket after EOF */
-		bridge_mod_io(ctx, READ_IO, DISABLE_IO);
+static void adjust_io(bridge_t *br, ctx_t *cli_ctx, ctx_t *srv_ctx)
+{
+	LOGGER_DBG( "ctx {%p} bridge {%p} cli queue {%s} srv queue {%s}\n",
+	                 ctx, br,
+					 (queue_is_full(br->cli.queue)) ? "FULL" : "NOT FULL",
+					 (queue_is_full(br->cli.queue)) ? "FULL" : "NOT FULL");
 
-		/* Put into closing map to be cleaned up by timer */
-		bridge_set_state(bridge, BRIDGE_STOPPING);
-		hashmap_put2(map_stopping, NULL, ctx);
-		hashmap_put2(map_stopping, NULL, peer);
+	int cli_full = bridge_budget_check(&br->cli) || socket_out_is_full(&br->cli) || socket_backlogged(br, &br->cli);
+	int srv_full = bridge_budget_check(&br->srv) || socket_out_is_full(&br->srv) || socket_backlogged(br, &br->srv);
 
-		/* Delete from active map */
-		hashmap_remove2(map_active, ctx);
-		hashmap_remove2(map_active, peer);
-	}
+	/* nothing to read after EOF */
+	if (cli_full || br->srv.eof) bridge_mod_io(srv_ctx, READ_IO, DISABLE_IO);
+	else                         bridge_mod_io(srv_ctx, READ_IO, ENABLE_IO);
 
-	if (drop) {
-		LOGGER_DBG( "_____removing bridge {%p} contexts ctx {%p} peer {%p}\n", bridge, ctx, peer);
+	if (srv_full || br->cli.eof) bridge_mod_io(cli_ctx, READ_IO, DISABLE_IO);
+	else                         bridge_mod_io(cli_ctx, READ_IO, ENABLE_IO);
 
-		bridge_set_state(bridge, BRIDGE_STOPPING);
-		hashmap_remove2(map_active, ctx);
-		hashmap_remove2(map_active, peer);
-	}
+	if (socket_out_is_empty(&br->cli)) bridge_mod_io(cli_ctx, WRITE_IO, DISABLE_IO);
+	else                               bridge_mod_io(cli_ctx, WRITE_IO, ENABLE_IO);
 
-	return;
+	if (socket_out_is_empty(&br->srv)) bridge_mod_io(srv_ctx, WRITE_IO, DISABLE_IO);
+	else                               bridge_mod_io(srv_ctx, WRITE_IO, ENABLE_IO);
 }
 
-static void handle_io_bridge_stopping(uint32_t events, ctx_t *ctx)
+/*
+ * ACTIVE and STOPPING bridges. After EOF on one side the other direction
+ * keeps forwarding at full speed. A direction is done once its source
+ * has seen EOF and everything queued for its destination is sent: the
+ * destination gets its FIN and gives back its buffers right away. The
+ * bridge goes when both directions are done, an error aborts it.
+ */
+static void handle_io_bridge_active(uint32_t events, ctx_t *ctx)
 {
 	int drop = 0;
 	int eof  = 0;
+	int done = 0;
+
 	bridge_t     *bridge = (bridge_t *)ctx->data;
 	ctx_t        *peer   = ctx->peer;
+	socket_ctx_t *sock   = bridge_socket(ctx);
 	send_queue_t *queue  = NULL;
 
-	LOGGER_DBG( "got an event {%"PRIu32"} from the bridge {%p} in BRIDGE_STOPPING state\n", events, ctx);
+	bridge->last_io = io_loop_now();
+
+	if (bridge->fastopen && BRIDGE_SRV_CTX == ctx->type && bridge_fastopen_check(bridge))
+		bridge_connect_done(bridge, !(events & EPOLLERR));
+
+	/* HUP after our FIN is the peer's FIN, a socket done both ways has nothing more to report */
+	if (events & EPOLLHUP && !(events & EPOLLERR) && sock->shut) {
+		events &= ~EPOLLHUP;
+		if (sock->eof)
+			io_del_sock(ctx->fd);
+		else
+			events |= EPOLLIN;
+	}
 
 	if (events & EPOLLERR || events & EPOLLHUP) {
-		LOGGER_DBG( "connection closed from %s fd {%d} bridge {%p}\n", type_str[ctx->type], ctx->fd, bridge);
+		if (BRIDGE_CLI_CTX == ctx->type) LOGGER_DBG( "connection closed from cli fd {%d} bridge {%p}\n", ctx->fd, bridge);
+		if (BRIDGE_SRV_CTX == ctx->type) LOGGER_DBG( "connection closed from srv fd {%d} bridge {%p}\n", ctx->fd, bridge);
 		drop++;
 	}
 
-	if (events & EPOLLIN) {
-		queue = (BRIDGE_CLI_CTX == ctx->type) ? bridge->srv.queue : bridge->cli.queue;
+	if (events & EPOLLIN && !sock->eof && bridge->splice) {
+		if (context_splice_read(ctx, &eof) < 0)
+			drop++;
+	} else if (events & EPOLLIN && !sock->eof) {
+		socket_ctx_t *out = (BRIDGE_CLI_CTX == ctx->type) ? &bridge->srv : &bridge->cli;
+
+		queue = bridge_queue(bridge, out);
 
 		while(1) {
-			char buf[QUEUE_SIZE];
-			ssize_t n = read(ctx->fd, buf, sizeof(buf));
+			struct iovec iov[QUEUE_TAIL_IOV];
+			size_t room = 0;
+			int    cnt  = 0;
+
+			if (!queue) {
+				LOGGER_DBG( "no send queue for fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
+				drop++;
+				break;
+			}
+
+			if (queue_is_full(queue))
+				break;
+
+			cnt = queue_tail_iov(queue, QUEUE_SIZE, iov);
+			if (!cnt) {
+				LOGGER_DBG( "no receive buffer for fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
+				drop++;
+				break;
+			}
+
+			room = iov[0].iov_len + ((cnt > 1) ? iov[1].iov_len : 0);
+
+			ssize_t n = io_read_sock(ctx->fd, iov, cnt);
 			if (!n) {
 				LOGGER_DBG( "remote peer {%d} has closed its writing end, bridge {%p}\n", ctx->fd, bridge);
+				sock->readable = 0;
 				eof++;
 				break;
 			} else if (n < 0) {
-				if (errno == EAGAIN || errno == EINTR)
+				if (errno == EAGAIN || errno == EINTR) {
+					if (EAGAIN == errno)
+						sock->readable = 0;
 					break;
+				}
 
 				LOGGER_DBG( "read error from fd {%d} ctx {%p} bridge {%p}\n", ctx->fd, ctx, bridge);
 				drop++;
 			} else {
-				// TODO: try to deliver instead of dropping
-				break;
+				if (BRIDGE_CLI_CTX == ctx->type) STATS_ADD(bytes_cli, n);
+				else                             STATS_ADD(bytes_srv, n);
+
+				queue_tail_commit(queue, n);
+
+				/* short read after EPOLLRDHUP: receive queue is drained up to FIN */
+				if (sock->rdhup && (size_t)n < room) {
+					LOGGER_DBG( "remote peer {%d} has closed its writing end (rdhup), bridge {%p}\n", ctx->fd, bridge);
+					sock->readable = 0;
+					eof++;
+					break;
+				}
+
 			}
 		}
+
+		/* give back the buffer of the last, unsuccessful read */
+		queue_tail_commit(queue, 0);
+		bridge_queue_trim(out);
+
+		profile_quickack(bridge->profile, ctx->fd);
 	}
 
 	if (events & EPOLLOUT) {
 		if (context_flush_queue(ctx) < 0)
 			drop++;
 
-		send_queue_t *queue  = (BRIDGE_CLI_CTX == ctx->type) ? bridge->cli.queue : bridge->srv.queue;
-		if (queue_is_empty(queue))
-			shutdown(ctx->fd, SHUT_WR);
+		if (bridge->profile && bridge->profile->notsent_lowat > 0)
+			sock->unsent = socket_unsent(ctx->fd);
 	}
 
-	if (!drop && eof) {
-		LOGGER_DBG("EOF from the opposite side bridge {%p} ctx {%p} fd {%d}\n", bridge, ctx, ctx->fd);
+	ctx_t *cli_ctx = (BRIDGE_CLI_CTX == ctx->type) ? ctx : ctx->peer;
+	ctx_t *srv_ctx = (BRIDGE_SRV_CTX == ctx->type) ? ctx : ctx->peer;
 
-		socket_ctx_t *peer_socket = (BRIDGE_CLI_CTX == ctx->type) ? &bridge->srv : &bridge->cli;
+	if (eof) {
+		LOGGER_DBG( "=== bridge {%p} ctx {%p <-> %s} EOF\n", bridge, ctx, type_str[ctx->type]);
 
-		if (peer_socket->eof)
-			drop++;
-		else
-			LOGGER_DBG(" BUG: How did get there bridge {%p} ctx {%p} fd {%d}\n", bridge, ctx, ctx->fd);
+		sock->eof++;
+
+		/* Move over to the stopping list, the stopping timer drops it if the peer never finishes */
+		if (BRIDGE_ACTIVE == bridge->state) {
+			bridge_set_state(bridge, BRIDGE_STOPPING);
+			bridge_arm_timer(bridge, srv_ctx);
+			context_list_put(list_stopping, ctx);
+			context_list_put(list_stopping, peer);
 
-		/* Stop reading from socket after EOF */
-		bridge_mod_io(ctx, READ_IO, DISABLE_IO);
+			STATS_DEC(active);
+			STATS_INC(stopping);
+		}
 	}
 
-	if (queue_is_empty(bridge->cli.queue) && queue_is_empty(bridge->srv.queue)) {
-		LOGGER_DBG( "all pending data has been sent\n");
-		drop++;
+	adjust_io(bridge, cli_ctx, srv_ctx);
+
+	if (config.sockmap && !bridge->sockmap && BRIDGE_ACTIVE == bridge->state && !drop)
+		bridge_sockmap(bridge);
+
+	if (!drop && BRIDGE_STOPPING == bridge->state) {
+		bridge_direction_done(bridge, &bridge->cli, &bridge->srv, srv_ctx);
+		bridge_direction_done(bridge, &bridge->srv, &bridge->cli, srv_ctx);
+
+		if (bridge->cli.shut && bridge->srv.shut) {
+			LOGGER_DBG( "bridge {%p} both directions are done\n", bridge);
+			done++;
+		}
 	}
 
-	if (drop) {
+	if (drop || done) {
 		LOGGER_DBG( "_____removing bridge {%p} contexts ctx {%p} peer {%p}\n", bridge, ctx, peer);
 
-		bridge_set_state(bridge, BRIDGE_STOPPED);
+		ctx_list_t *list = (BRIDGE_STOPPING == bridge->state) ? list_stopping : list_active;
+
+		if (drop)
+			bridge->abort = 1;
 
-		hashmap_remove2(map_stopping, ctx);
-		hashmap_remove2(map_stopping, peer);
+		if (list == list_stopping) STATS_DEC(stopping);
+		else                       STATS_DEC(active);
+
+		/* the lists may hold the last references, the bridge goes with them */
+		bridge_set_state(bridge, BRIDGE_STOPPED);
+		context_list_remove(list, ctx);
+		context_list_remove(list, peer);
 	}
+
+	return;
+}
+
+/* EPOLLERR also reports MSG_ZEROCOPY completions, only a socket error is fatal */
+static uint32_t context_zc_complete(ctx_t *ctx, uint32_t events)
+{
+	socket_ctx_t *sock = bridge_socket(ctx);
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (zc_complete(&sock->zc, ctx->fd, sock->queue) < 0)
+		return events;
+
+	if (getsockopt(ctx->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+		return events;
+
+	return events & ~EPOLLERR;
 }
 
 static void handle_io_bridge(uint32_t events, ctx_t *ctx)
@@ -499,15 +1141,22 @@ static void handle_io_bridge(uint32_t events, ctx_t *ctx)
 	if (!bridge)
 		return;
 
+	if (events & EPOLLERR && bridge_socket(ctx)->zc.enabled) {
+		events = context_zc_complete(ctx, events);
+		if (!events)
+			return;
+	}
+
 	switch (bridge->state) {
+		case BRIDGE_NEW:
+			handle_io_bridge_new(events, ctx);
+			break;
 		case BRIDGE_CONNECTING:
 			handle_io_bridge_connecting(events, ctx);
 			break;
 		case BRIDGE_ACTIVE:
-			handle_io_bridge_active(events, ctx);
-			break;
 		case BRIDGE_STOPPING:
-			handle_io_bridge_stopping(events, ctx);
+			handle_io_bridge_active(events, ctx);
 			break;
 		default:
 			break;
@@ -516,17 +1165,99 @@ static void handle_io_bridge(uint32_t events, ctx_t *ctx)
 	return;
 }
 
+/*
+ * Events the edge triggered engine still owes to a socket: readiness
+ * recorded from earlier edges, filtered by the userspace interest.
+ */
+static uint32_t bridge_pending_events(ctx_t *ctx)
+{
+	bridge_t     *bridge = (bridge_t *)ctx->data;
+	socket_ctx_t *sock   = bridge_socket(ctx);
+	uint32_t events = 0;
+
+	if (sock->readable && IO_ENABLED == sock->read_state)
+		events |= EPOLLIN;
+
+	if (sock->writable && IO_ENABLED == sock->write_state && !socket_out_is_empty(sock))
+		events |= EPOLLOUT;
+
+	if (BRIDGE_ACTIVE != bridge->state && BRIDGE_STOPPING != bridge->state)
+		events = 0;
+
+	return events;
+}
+
+static void handle_io_bridge_edge(uint32_t events, ctx_t *ctx)
+{
+	bridge_t     *bridge = (bridge_t *)ctx->data;
+	socket_ctx_t *sock   = NULL;
+	ctx_t        *peer   = NULL;
+
+	if (!bridge)
+		return;
+
+	sock = bridge_socket(ctx);
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		sock->readable = 1;
+	if (events & EPOLLOUT)
+		sock->writable = 1;
+	if (events & EPOLLRDHUP)
+		sock->rdhup = 1;
+
+	/* the handlers may drop the bridge from the lists, keep both contexts alive */
+	sp_dup(ctx);
+
+	events &= (EPOLLERR | EPOLLHUP);
+	if (BRIDGE_NEW == bridge->state)
+		events |= (sock->readable) ? EPOLLIN : 0;
+	else if (BRIDGE_CONNECTING == bridge->state)
+		events |= (sock->writable && BRIDGE_SRV_CTX == ctx->type) ? EPOLLOUT : 0;
+	else
+		events |= bridge_pending_events(ctx);
+
+	if (events)
+		handle_io_bridge(events, ctx);
+
+	peer = sp_dup(ctx->peer);
+
+	/*
+	 * No further edge is reported for readiness we have not consumed,
+	 * so service both sides until each one either hits EAGAIN or has
+	 * its interest switched off by the backpressure logic.
+	 */
+	while (1) {
+		uint32_t ctx_events  = bridge_pending_events(ctx);
+		uint32_t peer_events = (peer) ? bridge_pending_events(peer) : 0;
+
+		if (!ctx_events && !peer_events)
+			break;
+
+		if (ctx_events)
+			handle_io_bridge(ctx_events, ctx);
+
+		if (peer_events && bridge_pending_events(peer))
+			handle_io_bridge(bridge_pending_events(peer), peer);
+	}
+
+	if (peer)
+		sp_free(peer);
+
+	sp_free(ctx);
+}
+
 static void handle_io(uint32_t events, void *data)
 {
 	ctx_t *ctx = (ctx_t*)data;
 
 	char events_str[128] = {0};
 	snprintf(events_str, sizeof(events_str),
-	         "{%s} {%s} {%s} {%s}",
-	         (events & EPOLLIN)  ? "POLLIN"  : "-",
-	         (events & EPOLLOUT) ? "POLLOUT" : "-",
-	         (events & EPOLLERR) ? "POLLERR" : "-",
-	         (events & EPOLLHUP) ? "POLLHUP" : "-");
+	         "{%s} {%s} {%s} {%s} {%s}",
+	         (events & EPOLLIN)    ? "POLLIN"    : "-",
+	         (events & EPOLLOUT)   ? "POLLOUT"   : "-",
+	         (events & EPOLLERR)   ? "POLLERR"   : "-",
+	         (events & EPOLLHUP)   ? "POLLHUP"   : "-",
+	         (events & EPOLLRDHUP) ? "POLLRDHUP" : "-");
 
 	LOGGER_DBG( "handle_io: ctx {%p <-> %s} events %s fd {%d}\n", ctx, type_str[ctx->type], events_str, ctx->fd);
 
@@ -535,95 +1266,413 @@ static void handle_io(uint32_t events, void *data)
 
 	if (LISTEN_CTX == ctx->type)
 		handle_io_listener(events, ctx);
-	if (BRIDGE_CLI_CTX == ctx->type || BRIDGE_SRV_CTX == ctx->type)
-		handle_io_bridge(events, ctx);
+	if (BRIDGE_CLI_CTX == ctx->type || BRIDGE_SRV_CTX == ctx->type) {
+		if (config.edge_triggered)
+			handle_io_bridge_edge(events, ctx);
+		else
+			handle_io_bridge(events, ctx);
+	}
 
 	return;
 }
 
-static int check_bridge_timeout(any_t arg, any_t obj)
+/*
+ * Upgrade, old binary: every bridge goes once, through its srv ctx or
+ * the cli ctx of a lazy bridge. A handed over bridge closes its fds
+ * without a FIN or RST, the new binary holds the sockets now.
+ */
+static int bridge_handover(void *arg, ctx_t *ctx)
+{
+	bridge_t *bridge = (bridge_t*)ctx->data;
+	upgrade_bridge_t rec;
+	char *buf = NULL;
+
+	if (LISTEN_CTX == ctx->type || (BRIDGE_CLI_CTX == ctx->type && bridge->srv.fd >= 0))
+		return 0;
+
+	if (bridge_export(bridge, &rec, &buf) < 0 || upgrade_send_bridge(&rec, bridge->cli.fd, bridge->srv.fd, buf) < 0) {
+		LOGGER_ERR( "worker {%d} failed to hand bridge {%p} over, reset\n", ((worker_t*)arg)->id, bridge);
+		bridge->abort = 1;
+	} else {
+		STATS_INC(handed_over);
+	}
+
+	if (BRIDGE_NEW == bridge->state)           STATS_DEC(lazy);
+	else if (BRIDGE_STOPPING == bridge->state) STATS_DEC(stopping);
+	else                                       STATS_DEC(active);
+
+	if (buf)
+		sp_free(buf);
+
+	return 0;
+}
+
+/* upgrade, new binary: contexts, io and timers of a bridge the old one handed over */
+static void bridge_adopt(upgrade_import_t *imp)
 {
-	ctx_t    *ctx    = NULL;
-	bridge_t *bridge = NULL;
-	time_t   *current = (time_t*)arg;
+	bridge_t *bridge  = bridge_import(imp, config.ring_size);
+	ctx_t    *cli_ctx = NULL;
+	ctx_t    *srv_ctx = NULL;
+	ctx_list_t *list  = NULL;
+	int rc = -1;
 
-	ctx = (ctx_t*)obj;
-	if (!ctx)
-		return MAP_MISSING;
+	if (!bridge)
+		return;
+
+	do {
+		if (BRIDGE_NEW == bridge->state) {
+			rc = bridge_lazy(bridge);
+			break;
+		}
+
+		srv_ctx = context_create(bridge->srv.fd, BRIDGE_SRV_CTX, bridge, destroy_context_cb);
+		if (!srv_ctx)
+			break;
 
-	bridge = (bridge_t*)ctx->data;
-	if (*current - bridge->stopping >= STOPPING_TIMEOUT) {
-		LOGGER_DBG( "bridge {%p} is staying in BRIDGE_STOPPING for too long, stop it\n", bridge);
-		return MAP_OK;
+		/* the client side comes with the connect, see handle_io_bridge_connecting() */
+		if (BRIDGE_CONNECTING == bridge->state) {
+			bridge_mod_io(srv_ctx, WRITE_IO, ENABLE_IO);
+			context_list_put(list_active, srv_ctx);
+			bridge_arm_timer(bridge, srv_ctx);
+			STATS_INC(active);
+			rc = 0;
+			break;
+		}
+
+		if (BRIDGE_ACTIVE != bridge->state && BRIDGE_STOPPING != bridge->state)
+			break;
+
+		cli_ctx = context_create(bridge->cli.fd, BRIDGE_CLI_CTX, bridge, destroy_context_cb);
+		if (!cli_ctx)
+			break;
+
+		context_set_peer(cli_ctx, srv_ctx);
+		context_set_peer(srv_ctx, cli_ctx);
+
+		/* queued bytes stay on the queues, pipes are for a bridge with nothing in flight */
+		if (config.splice && !bridge->cli.queue && !bridge->srv.queue && bridge_enable_splice(bridge) < 0)
+			LOGGER_DBG( "bridge {%p} has no pipes, falling back to queues\n", bridge);
+
+		if (config.zerocopy && !bridge->splice && !bridge->ring_size) {
+			zc_enable(&bridge->cli.zc, bridge->cli.fd);
+			zc_enable(&bridge->srv.zc, bridge->srv.fd);
+		}
+
+		list = (BRIDGE_ACTIVE == bridge->state) ? list_active : list_stopping;
+		context_list_put(list, cli_ctx);
+		context_list_put(list, srv_ctx);
+
+		if (BRIDGE_ACTIVE == bridge->state) STATS_INC(active);
+		else                                STATS_INC(stopping);
+
+		activate_bridge(cli_ctx, srv_ctx);
+		adjust_io(bridge, cli_ctx, srv_ctx);
+		bridge_arm_timer(bridge, srv_ctx);
+
+		if (config.autosize)
+			io_timer_arm(&bridge->autosize, (uint32_t)config.autosize, bridge_autosize_timer, srv_ctx);
+
+		/* a FIN the kernel forwarding still held back goes now, the sockhash is left behind */
+		if (BRIDGE_STOPPING == bridge->state) {
+			bridge_direction_done(bridge, &bridge->cli, &bridge->srv, srv_ctx);
+			bridge_direction_done(bridge, &bridge->srv, &bridge->cli, srv_ctx);
+
+			if (bridge->cli.shut && bridge->srv.shut) {
+				STATS_DEC(stopping);
+				bridge_set_state(bridge, BRIDGE_STOPPED);
+				context_list_remove(list_stopping, cli_ctx);
+				context_list_remove(list_stopping, srv_ctx);
+			}
+		}
+
+		rc = 0;
+	} while(0);
+
+	if (rc < 0) {
+		LOGGER_DBG( "bridge {%p} handed over could not be resumed\n", bridge);
+		bridge->abort = 1;
+	} else {
+		STATS_INC(taken_over);
 	}
 
-	return MAP_MISSING;
+	if (cli_ctx)
+		sp_free(cli_ctx);
+
+	if (srv_ctx)
+		sp_free(srv_ctx);
+
+	sp_free(bridge);
 }
 
-static void handle_timer(uint32_t events, void *ctx)
+static void *worker_run(void *arg)
 {
-	time_t current = time(NULL);
+	worker_t   *worker = (worker_t*)arg;
+	listener_t **listeners = worker->listeners;
+	ctx_t      *listen_contexts[MAX_LISTENERS] = { NULL };
+	upgrade_import_t *imp  = NULL;
+	upgrade_import_t *next = NULL;
+	int i = 0;
 
-	hashmap_cleanByCondition(map_stopping, check_bridge_timeout, &current, NULL);
+	stats_attach(worker->id);
 
-	return;
+	if (config.cpu_affinity)
+		affinity_pin(worker->id);
+
+	do {
+		list_active = context_list_new();
+		if (!list_active)
+			break;
+
+		list_stopping = context_list_new();
+		if (!list_stopping)
+			break;
+
+		if (health_attach() < 0) {
+			LOGGER_ERR( "worker {%d} failed to allocate the destination health table\n", worker->id);
+			break;
+		}
+
+		if (ratelimit_attach() < 0) {
+			LOGGER_ERR( "worker {%d} failed to allocate the rate limit table\n", worker->id);
+			break;
+		}
+
+		if (io_loop_init(handle_io, NULL, 1000) < 0) {
+			LOGGER_ERR( "worker {%d} failed to init io_loop\n", worker->id);
+			break;
+		}
+
+		for (i = 0; i < config.nports; i++) {
+			listen_contexts[i] = context_create(listeners[i]->fd, LISTEN_CTX, listeners[i], destroy_context_cb);
+			if (!listen_contexts[i]) {
+				LOGGER_DBG( "failed to create listener context\n");
+				break;
+			}
+
+			context_list_put(list_active, listen_contexts[i]);
+
+			io_add_sock(listeners[i]->fd, EPOLLIN, (void*)listen_contexts[i]);
+
+			/* the next binary takes the listeners over, nothing may wait accepted in the ring */
+			if (!config.upgrade)
+				io_ring_listener(listeners[i]->fd);
+		}
+
+		if (i < config.nports)
+			break;
+
+		/* bridges handed over by the old binary go on where they stopped */
+		for (imp = upgrade_imports(worker->id); imp; imp = next) {
+			next = imp->next;
+			bridge_adopt(imp);
+			upgrade_import_free(imp);
+		}
+
+		io_loop_run();
+
+		LOGGER_DBG( "worker {%d} io_loop finished\n", worker->id);
+
+		/* stopped for a new binary: it takes the bridges, ours go without a FIN */
+		if (upgrade_active()) {
+			context_list_iterate(list_active,   bridge_handover, worker);
+			context_list_iterate(list_stopping, bridge_handover, worker);
+		}
+	} while(0);
+
+	for (i = 0; i < config.nports; i++) {
+		if (listen_contexts[i])
+			sp_free(listen_contexts[i]);
+	}
+
+	if (list_active)
+		sp_free(list_active);
+
+	if (list_stopping)
+		sp_free(list_stopping);
+
+	/* bridges are gone by now, their pipes and buffers are back in the pools */
+	ratelimit_detach();
+	health_detach();
+	zc_cleanup();
+	pipe_pool_destroy();
+	buf_pool_destroy();
+
+	__atomic_sub_fetch(&workers_alive, 1, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+/*
+ * Upgrade, old binary: the listeners go first, the new binary accepts
+ * from them right away. The workers stop then and hand their bridges
+ * over on their way out, see bridge_handover().
+ */
+static void upgrade_handover(worker_t *workers)
+{
+	int i = 0;
+	int j = 0;
+
+	LOGGER_ERR( "a new binary is taking over on {%s}\n", config.upgrade);
+
+	for (i = 0; i < config.threads; i++)
+		for (j = 0; j < config.nports; j++)
+			if (workers[i].listeners[j])
+				upgrade_send_listener(config.ports[j], workers[i].listeners[j]->fd);
+
+	io_loop_stop();
 }
 
 int main(int ac, char **av)
 {
-	listener_t *listener = NULL;
-	ctx_t      *listen_context = NULL;
-	int rc = -1;
+	worker_t *workers = NULL;
+	sigset_t  sigs;
+	int sig_fd     = -1;
+	int upgrade_fd = -1;
+	int i = 0;
 
 	signal(SIGPIPE, SIG_IGN);
 
+	if (config_parse(ac, av) < 0)
+		return 1;
+
+	/* block the control signals in every thread, main thread reads them from a signalfd */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
 	do {
-		map_active = hashmap_new();
-		if (!map_active)
+		if (stats_init(config.threads) < 0)
 			break;
 
-		map_stopping = hashmap_new();
-		if (!map_stopping)
+		sig_fd = signalfd(-1, &sigs, SFD_CLOEXEC);
+		if (sig_fd < 0)
 			break;
 
-		if (io_loop_init(handle_io, handle_timer, 1000) < 0) {
-			LOGGER_DBG( "failed to init io_loop\n");
-			break;
+		budget_init(config.budget);
+		ratelimit_init(config.rate_limit, config.rate_burst, config.conn_limit, config.threads);
+		health_init(config.breaker, config.breaker_backoff);
+
+		if (config.sockmap && sockmap_init() < 0) {
+			LOGGER_ERR( "sockmap is not available, forwarding in userspace%s\n", "");
+			config.sockmap = 0;
 		}
 
-		listener = listener_create(1025);
-		if (!listener) {
-			LOGGER_DBG( "failed to create listener\n");
-			break;
+		if (config.uring && IO_BACKEND_URING != io_loop_set_backend(IO_BACKEND_URING))
+			config.uring = 0;
+
+		if (config.cpu_affinity && affinity_init(config.threads) < 0) {
+			LOGGER_ERR( "no usable cpus, workers are not pinned%s\n", "");
+			config.cpu_affinity = 0;
 		}
 
-		LOGGER_DBG("Listener {%p ; fd => %d} created\n", listener, listener->fd);
+		workers = sp_t_calloc(config.threads * sizeof(worker_t), NULL, "_worker_t_");
+		if (!workers)
+			break;
 
-		listen_context = context_create(listener->fd, LISTEN_CTX, listener, destroy_context_cb);
-		if (!listen_context) {
-			LOGGER_DBG( "failed to create listener context\n");
+		/* an old binary serving the path hands everything over before we start */
+		if (config.upgrade && upgrade_take(config.upgrade, config.threads) < 0)
 			break;
+
+		/*
+		 * the reuseport group of a port numbers its listeners in the order
+		 * they listen(), create them worker by worker before any of them
+		 * runs: the steering program returns worker ids
+		 */
+		for (i = 0; i < config.threads * config.nports; i++) {
+			worker_t *worker = &workers[i / config.nports];
+			int       port   = i % config.nports;
+			int       fd     = upgrade_listener(config.ports[port]);
+
+			if (fd >= 0)
+				worker->listeners[port] = listener_adopt(fd, config.ports[port], config.defer_accept, config.listen_fastopen);
+			else
+				worker->listeners[port] = listener_create(config.ports[port], config.defer_accept, config.listen_fastopen);
+			if (!worker->listeners[port]) {
+				LOGGER_ERR( "worker {%d} failed to create listener on port {%d}\n", i / config.nports, config.ports[port]);
+				break;
+			}
+
+			LOGGER_DBG("worker {%d} listener {%p ; fd => %d} created\n", i / config.nports, worker->listeners[port], worker->listeners[port]->fd);
 		}
 
-		hashmap_put2(map_active, NULL, listen_context);
+		if (i < config.threads * config.nports)
+			break;
 
-		io_add_sock(listener->fd, EPOLLIN, (void*)listen_context);
-		io_loop_run();
+		upgrade_close_listeners();
+
+		for (i = 0; config.cpu_affinity && i < config.nports; i++)
+			affinity_steer(workers[0].listeners[i]->fd);
 
-		LOGGER_DBG( "io_loop finished\n");
+		for (i = 0; i < config.threads; i++) {
+			workers[i].id = i;
+
+			__atomic_add_fetch(&workers_alive, 1, __ATOMIC_RELAXED);
+			if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+				LOGGER_ERR( "failed to start worker {%d}\n", i);
+				__atomic_sub_fetch(&workers_alive, 1, __ATOMIC_RELAXED);
+				io_loop_stop();
+				break;
+			}
+
+			workers[i].started = 1;
+		}
+
+		/* the workers are up, the next binary may take over from us */
+		if (config.upgrade)
+			upgrade_fd = upgrade_serve(config.upgrade);
+
+		while (__atomic_load_n(&workers_alive, __ATOMIC_RELAXED) > 0) {
+			struct pollfd pfd[2] = { { sig_fd, POLLIN, 0 }, { upgrade_fd, POLLIN, 0 } };
+			struct signalfd_siginfo si;
+
+			if (poll(pfd, 2, 1000) <= 0)
+				continue;
+
+			if (pfd[0].revents & POLLIN && sizeof(si) == read(sig_fd, &si, sizeof(si))) {
+				if (SIGUSR1 == si.ssi_signo)
+					stats_dump(stderr);
+				else if (SIGINT == si.ssi_signo || SIGTERM == si.ssi_signo)
+					io_loop_stop();
+			}
+
+			if (pfd[1].revents & POLLIN && !upgrade_active() && !io_loop_stopped() && !upgrade_begin(upgrade_fd))
+				upgrade_handover(workers);
+		}
+
+		LOGGER_DBG( "all workers finished\n");
 	} while(0);
 
-	if (listen_context)
-		sp_free(listen_context);
+	for (i = 0; workers && i < config.threads; i++) {
+		int j = 0;
+
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+
+		/* the ones no worker took over */
+		for (j = 0; j < config.nports; j++)
+			if (workers[i].listeners[j])
+				sp_free(workers[i].listeners[j]);
+	}
+
+	if (workers)
+		sp_free(workers);
+
+	/* the path belongs to the new binary once it took over */
+	if (upgrade_fd >= 0) {
+		if (!upgrade_active())
+			unlink(config.upgrade);
+		close(upgrade_fd);
+	}
 
-	if (listener)
-		sp_free(listener);
+	upgrade_end();
+	upgrade_release();
 
-	if (map_active)
-		sp_free(map_active);
+	if (sig_fd >= 0)
+		close(sig_fd);
 
-	if (map_stopping)
-		sp_free(map_stopping);
+	stats_dump(stderr);
 
 	return 0;
 }
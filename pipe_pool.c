@@ -0,0 +1,82 @@
+/*
+ * pipe_pool.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "pipe_pool.h"
+#include "logger.h"
+#include "stats.h"
+
+static __thread pipe_t pool[PIPE_POOL_SIZE];
+static __thread int    pool_num = 0;
+
+int pipe_pool_get(pipe_t *this)
+{
+	int fds[2] = {-1, -1};
+	int size = 0;
+
+	if (!this)
+		return -1;
+
+	if (pool_num > 0) {
+		*this = pool[--pool_num];
+		return 0;
+	}
+
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+		LOGGER_DBG( "pipe2 failed\n");
+		return -1;
+	}
+
+	STATS_INC(pipes_created);
+
+	/* may be refused by pipe-max-size, stay with what we've got then */
+	fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+	size = fcntl(fds[1], F_GETPIPE_SZ);
+	if (size <= 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	memset(this, 0, sizeof(*this));
+	this->rfd  = fds[0];
+	this->wfd  = fds[1];
+	this->size = (size_t)size;
+
+	return 0;
+}
+
+void pipe_pool_put(pipe_t *this)
+{
+	if (!this || this->rfd < 0)
+		return;
+
+	if (!this->len && pool_num < PIPE_POOL_SIZE) {
+		this->full = 0;
+		pool[pool_num++] = *this;
+	} else {
+		close(this->rfd);
+		close(this->wfd);
+	}
+
+	this->rfd = this->wfd = -1;
+}
+
+void pipe_pool_destroy(void)
+{
+	while (pool_num > 0) {
+		pool_num--;
+		close(pool[pool_num].rfd);
+		close(pool[pool_num].wfd);
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * pipe_pool.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef PIPE_POOL_H_
+#define PIPE_POOL_H_
+
+#include <stddef.h>
+
+#define PIPE_SIZE      64*1024
+#define PIPE_POOL_SIZE 256
+
+typedef struct pipe_type
+{
+	int rfd;		//!< read end, -1 when no pipe is attached
+	int wfd;		//!< write end
+	size_t size;	//!< pipe capacity
+	size_t len;		//!< bytes spliced in and not spliced out yet
+	int full;		//!< splice in got EAGAIN with data in the pipe: out of pipe buffers
+} pipe_t;
+
+/*
+ * Per-thread pool of empty pipes. pipe_pool_put() keeps only drained
+ * pipes, a pipe with data left in it is closed.
+ */
+int  pipe_pool_get(pipe_t *this);
+void pipe_pool_put(pipe_t *this);
+void pipe_pool_destroy(void);
+
+#endif /* PIPE_POOL_H_ */
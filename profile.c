@@ -0,0 +1,292 @@
+/*
+ * profile.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "profile.h"
+#include "config.h"
+#include "logger.h"
+
+typedef struct profile_rule_type
+{
+	unsigned short lo;
+	unsigned short hi;
+	const profile_t *profile;
+} profile_rule_t;
+
+/* filled by config_parse() before the workers start, read only after that */
+static profile_t      profiles[MAX_PROFILES];
+static int            nprofiles = 0;
+static profile_rule_t listen_rules[MAX_PROFILE_RULES];
+static int            nlisten_rules = 0;
+static profile_rule_t dst_rules[MAX_PROFILE_RULES];
+static int            ndst_rules = 0;
+
+static const struct
+{
+	const char *key;
+	size_t offset;
+} int_keys[] = {
+	{ "nodelay",      offsetof(profile_t, nodelay) },
+	{ "quickack",     offsetof(profile_t, quickack) },
+	{ "sndbuf",       offsetof(profile_t, sndbuf) },
+	{ "rcvbuf",       offsetof(profile_t, rcvbuf) },
+	{ "keepalive",    offsetof(profile_t, keepalive) },
+	{ "keepintvl",    offsetof(profile_t, keepintvl) },
+	{ "keepcnt",      offsetof(profile_t, keepcnt) },
+	{ "user_timeout", offsetof(profile_t, user_timeout) },
+	{ "rcvlowat",     offsetof(profile_t, rcvlowat) },
+	{ "notsent_lowat", offsetof(profile_t, notsent_lowat) },
+	{ "ring",         offsetof(profile_t, ring) },
+};
+
+static profile_t *__find(const char *name)
+{
+	int i = 0;
+
+	for (i = 0; i < nprofiles; i++)
+		if (!strcmp(profiles[i].name, name))
+			return &profiles[i];
+
+	return NULL;
+}
+
+/* the congestion control must be built in or loaded, check it up front */
+static int __cc_check(const char *cc)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int rc = -1;
+
+	if (fd < 0)
+		return -1;
+
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, cc, strlen(cc));
+	close(fd);
+
+	return rc;
+}
+
+static int __set_option(profile_t *this, const char *key, const char *value)
+{
+	size_t i = 0;
+	char  *end = NULL;
+	long   val = 0;
+
+	if (!strcmp(key, "cc")) {
+		if (!*value || strlen(value) >= PROFILE_CC_LEN || __cc_check(value) < 0) {
+			LOGGER_ERR("profile {%s}: congestion control {%s} is not available\n", this->name, value);
+			return -1;
+		}
+
+		strcpy(this->cc, value);
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(int_keys) / sizeof(int_keys[0]); i++) {
+		if (strcmp(key, int_keys[i].key))
+			continue;
+
+		val = strtol(value, &end, 10);
+		if (!*value || *end || val < 0 || val > INT_MAX) {
+			LOGGER_ERR("profile {%s}: invalid %s {%s}\n", this->name, key, value);
+			return -1;
+		}
+
+		if (offsetof(profile_t, ring) == int_keys[i].offset && val > MAX_RING_SIZE) {
+			LOGGER_ERR("profile {%s}: ring {%s} is over %d\n", this->name, value, MAX_RING_SIZE);
+			return -1;
+		}
+
+		*(int*)((char*)this + int_keys[i].offset) = (int)val;
+		return 0;
+	}
+
+	LOGGER_ERR("profile {%s}: unknown option {%s}\n", this->name, key);
+	return -1;
+}
+
+int profile_define(const char *spec)
+{
+	char       buf[256];
+	char      *opts  = NULL;
+	char      *save  = NULL;
+	char      *tok   = NULL;
+	profile_t *this  = NULL;
+
+	if (strlen(spec) >= sizeof(buf)) {
+		LOGGER_ERR("profile {%s} is too long\n", spec);
+		return -1;
+	}
+
+	strcpy(buf, spec);
+
+	opts = strchr(buf, ':');
+	if (opts)
+		*opts++ = '\0';
+
+	if (!*buf || strlen(buf) >= PROFILE_NAME_LEN || __find(buf)) {
+		LOGGER_ERR("invalid or duplicate profile name {%s}\n", buf);
+		return -1;
+	}
+
+	if (nprofiles >= MAX_PROFILES) {
+		LOGGER_ERR("too many profiles, at most %d\n", MAX_PROFILES);
+		return -1;
+	}
+
+	this = &profiles[nprofiles];
+	memset(this, 0, sizeof(*this));
+	strcpy(this->name, buf);
+	this->nodelay = this->quickack = this->sndbuf = this->rcvbuf = -1;
+	this->keepalive = this->keepintvl = this->keepcnt = this->user_timeout = -1;
+	this->rcvlowat = this->notsent_lowat = this->ring = -1;
+
+	for (tok = (opts) ? strtok_r(opts, ",", &save) : NULL; tok; tok = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(tok, '=');
+
+		if (!value) {
+			LOGGER_ERR("profile {%s}: option {%s} has no value\n", this->name, tok);
+			return -1;
+		}
+
+		*value++ = '\0';
+		if (__set_option(this, tok, value) < 0)
+			return -1;
+	}
+
+	nprofiles++;
+
+	return 0;
+}
+
+static int __bind(const char *spec, profile_rule_t *rules, int *nrules, int range)
+{
+	const char *name = strchr(spec, '=');
+	char       *end  = NULL;
+	long        lo   = 0;
+	long        hi   = 0;
+
+	do {
+		if (!name)
+			break;
+
+		lo = hi = strtol(spec, &end, 10);
+		if (range && '-' == *end)
+			hi = strtol(end + 1, &end, 10);
+
+		if (end != name || lo <= 0 || hi < lo || hi > 65535)
+			break;
+
+		if (*nrules >= MAX_PROFILE_RULES) {
+			LOGGER_ERR("too many profile rules, at most %d\n", MAX_PROFILE_RULES);
+			return -1;
+		}
+
+		rules[*nrules].profile = __find(name + 1);
+		if (!rules[*nrules].profile) {
+			LOGGER_ERR("unknown profile {%s}, define it first\n", name + 1);
+			return -1;
+		}
+
+		rules[*nrules].lo = (unsigned short)lo;
+		rules[*nrules].hi = (unsigned short)hi;
+		(*nrules)++;
+
+		return 0;
+	} while(0);
+
+	LOGGER_ERR("invalid profile rule {%s}\n", spec);
+
+	return -1;
+}
+
+int profile_bind_listener(const char *spec)
+{
+	return __bind(spec, listen_rules, &nlisten_rules, 0);
+}
+
+int profile_bind_dst(const char *spec)
+{
+	return __bind(spec, dst_rules, &ndst_rules, 1);
+}
+
+const profile_t *profile_lookup(unsigned short listen_port, unsigned short dst_port)
+{
+	int i = 0;
+
+	/* first match, in the order of the command line */
+	for (i = 0; i < ndst_rules; i++)
+		if (dst_port >= dst_rules[i].lo && dst_port <= dst_rules[i].hi)
+			return dst_rules[i].profile;
+
+	for (i = 0; i < nlisten_rules; i++)
+		if (listen_port == listen_rules[i].lo)
+			return listen_rules[i].profile;
+
+	return NULL;
+}
+
+static int __setsockopt(int fd, int level, int opt, int val, const char *name)
+{
+	if (val < 0)
+		return 0;
+
+	if (setsockopt(fd, level, opt, &val, sizeof(val)) < 0) {
+		LOGGER_DBG( "%s {%d} on fd {%d} failed: %s\n", name, val, fd, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a failed option does not stop the rest, returns -1 if any failed */
+int profile_apply(const profile_t *this, int fd)
+{
+	int rc = 0;
+
+	if (!this)
+		return 0;
+
+	rc |= __setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,  this->nodelay,  "TCP_NODELAY");
+	rc |= __setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, this->quickack, "TCP_QUICKACK");
+	rc |= __setsockopt(fd, SOL_SOCKET,  SO_SNDBUF,    this->sndbuf,   "SO_SNDBUF");
+	rc |= __setsockopt(fd, SOL_SOCKET,  SO_RCVBUF,    this->rcvbuf,   "SO_RCVBUF");
+
+	if (this->keepalive >= 0)
+		rc |= __setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, !!this->keepalive, "SO_KEEPALIVE");
+	if (this->keepalive > 0)
+		rc |= __setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, this->keepalive, "TCP_KEEPIDLE");
+
+	rc |= __setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,    this->keepintvl,    "TCP_KEEPINTVL");
+	rc |= __setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,      this->keepcnt,      "TCP_KEEPCNT");
+	rc |= __setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, this->user_timeout, "TCP_USER_TIMEOUT");
+	rc |= __setsockopt(fd, SOL_SOCKET,  SO_RCVLOWAT,      this->rcvlowat,     "SO_RCVLOWAT");
+	rc |= __setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, this->notsent_lowat, "TCP_NOTSENT_LOWAT");
+
+	if (this->cc[0] && setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, this->cc, strlen(this->cc)) < 0) {
+		LOGGER_DBG( "TCP_CONGESTION {%s} on fd {%d} failed: %s\n", this->cc, fd, strerror(errno));
+		rc = -1;
+	}
+
+	return rc;
+}
+
+void profile_quickack(const profile_t *this, int fd)
+{
+	if (this && this->quickack > 0)
+		__setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+}
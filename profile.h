@@ -0,0 +1,51 @@
+/*
+ * profile.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#define MAX_PROFILES       16
+#define MAX_PROFILE_RULES  32
+#define PROFILE_NAME_LEN   32
+#define PROFILE_CC_LEN     16	//!< TCP_CA_NAME_MAX
+
+/*
+ * Named socket tuning, applied to both sockets of a bridge. -1 (or an
+ * empty congestion name) leaves the kernel default alone.
+ */
+typedef struct profile_type
+{
+	char name[PROFILE_NAME_LEN];
+	int nodelay;			//!< TCP_NODELAY
+	int quickack;			//!< TCP_QUICKACK, re-armed after reads as the kernel drops it
+	int sndbuf;				//!< SO_SNDBUF bytes
+	int rcvbuf;				//!< SO_RCVBUF bytes
+	char cc[PROFILE_CC_LEN];	//!< TCP_CONGESTION
+	int keepalive;			//!< TCP_KEEPIDLE seconds with SO_KEEPALIVE, 0 - keepalive off
+	int keepintvl;			//!< TCP_KEEPINTVL seconds
+	int keepcnt;			//!< TCP_KEEPCNT probes
+	int user_timeout;		//!< TCP_USER_TIMEOUT ms
+	int rcvlowat;			//!< SO_RCVLOWAT bytes, one way bulk flows only: a shorter tail waits for FIN
+	int notsent_lowat;		//!< TCP_NOTSENT_LOWAT bytes, also caps what waits in the queue behind it
+	int ring;				//!< ring queue capacity of the bridge, 0 - node lists, -1 - --ring
+} profile_t;
+
+/* "name:key=value,..." with keys nodelay, quickack, sndbuf, rcvbuf, cc,
+ * keepalive, keepintvl, keepcnt, user_timeout, rcvlowat, notsent_lowat, ring */
+int profile_define(const char *spec);
+
+/* "port=name" for a listening port, "port[-port]=name" for destinations */
+int profile_bind_listener(const char *spec);
+int profile_bind_dst(const char *spec);
+
+/* a destination range wins over the listening port, NULL - no profile */
+const profile_t *profile_lookup(unsigned short listen_port, unsigned short dst_port);
+
+int  profile_apply(const profile_t *this, int fd);
+void profile_quickack(const profile_t *this, int fd);
+
+#endif /* PROFILE_H_ */
@@ -0,0 +1,191 @@
+/*
+ * ratelimit.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ratelimit.h"
+#include "io_loop.h"
+#include "stats.h"
+#include "sp.h"
+
+#define MILLI 1000	//!< tokens are kept in thousandths, refilled by the ms
+
+typedef struct ratelimit_entry_type
+{
+	uint32_t addr;		//!< source address, 0 - free entry
+	uint32_t tokens;	//!< thousandths of a connection left in the bucket
+	uint32_t stamp;		//!< io_loop_now() of the last admit, the refill base and LRU age
+	uint32_t conns;		//!< admitted bridges still open
+} ratelimit_entry_t;
+
+typedef struct ratelimit_set_type
+{
+	ratelimit_entry_t way[RATELIMIT_WAYS];
+} __attribute__((aligned(64))) ratelimit_set_t;
+
+/* the share of one worker, read only once the workers run */
+static uint32_t limit_rate  = 0;	//!< connections per second, thousandths per ms
+static uint32_t limit_burst = 0;	//!< bucket size in thousandths
+static uint32_t limit_conns = 0;
+
+static __thread ratelimit_set_t *table = NULL;
+
+static uint32_t __share(uint32_t limit, int workers)
+{
+	return (limit + (uint32_t)workers - 1) / (uint32_t)workers;
+}
+
+void ratelimit_init(uint32_t rate, uint32_t burst, uint32_t conns, int workers)
+{
+	if (workers < 1)
+		workers = 1;
+
+	if (burst < rate)
+		burst = rate;
+	if (burst > RATELIMIT_MAX_BURST)
+		burst = RATELIMIT_MAX_BURST;
+
+	limit_rate  = __share(rate, workers);
+	limit_burst = __share(burst, workers) * MILLI;
+	limit_conns = __share(conns, workers);
+}
+
+int ratelimit_attach(void)
+{
+	if (!limit_rate && !limit_conns)
+		return 0;
+
+	table = sp_calloc(RATELIMIT_SETS * sizeof(ratelimit_set_t));
+
+	return (table) ? 0 : -1;
+}
+
+void ratelimit_detach(void)
+{
+	if (table)
+		sp_free(table);
+
+	table = NULL;
+}
+
+int ratelimit_enabled(void)
+{
+	return (table != NULL);
+}
+
+static ratelimit_set_t *__set(uint32_t addr)
+{
+	/* Fibonacci hashing, the high bits are the well mixed ones */
+	return &table[(uint32_t)(addr * 2654435761u) >> (32 - RATELIMIT_BITS)];
+}
+
+/* free entries go first, then the ones without bridges, the oldest of them */
+static int __colder(const ratelimit_entry_t *a, const ratelimit_entry_t *b, uint32_t now)
+{
+	if (!a->addr != !b->addr)
+		return !a->addr;
+
+	if (!a->conns != !b->conns)
+		return !a->conns;
+
+	return (uint32_t)(now - a->stamp) > (uint32_t)(now - b->stamp);
+}
+
+static ratelimit_entry_t *__entry(uint32_t addr, uint32_t now)
+{
+	ratelimit_set_t   *set    = __set(addr);
+	ratelimit_entry_t *victim = &set->way[0];
+	int i = 0;
+
+	for (i = 0; i < RATELIMIT_WAYS; i++) {
+		if (set->way[i].addr == addr)
+			return &set->way[i];
+
+		if (__colder(&set->way[i], victim, now))
+			victim = &set->way[i];
+	}
+
+	/* the bridges of an evicted busy source are not counted anymore, it fails open */
+	if (victim->addr)
+		STATS_INC(ratelimit_evictions);
+
+	victim->addr   = addr;
+	victim->tokens = limit_burst;
+	victim->stamp  = now;
+	victim->conns  = 0;
+
+	return victim;
+}
+
+ratelimit_verdict_t ratelimit_admit(uint32_t addr)
+{
+	ratelimit_entry_t *entry  = NULL;
+	uint32_t           now    = 0;
+	uint64_t           tokens = 0;
+
+	if (!table || !addr)
+		return RATELIMIT_PASS;
+
+	now   = (uint32_t)io_loop_now();
+	entry = __entry(addr, now);
+
+	if (limit_conns && entry->conns >= limit_conns)
+		return RATELIMIT_CONNS;
+
+	if (limit_rate) {
+		tokens = entry->tokens + (uint64_t)(uint32_t)(now - entry->stamp) * limit_rate;
+		if (tokens > limit_burst)
+			tokens = limit_burst;
+
+		entry->tokens = (uint32_t)tokens;
+		entry->stamp  = now;
+
+		if (entry->tokens < MILLI)
+			return RATELIMIT_RATE;
+
+		entry->tokens -= MILLI;
+	}
+
+	entry->stamp = now;
+	entry->conns++;
+
+	return RATELIMIT_PASS;
+}
+
+void ratelimit_adopt(uint32_t addr)
+{
+	ratelimit_entry_t *entry = NULL;
+	uint32_t           now   = 0;
+
+	if (!table || !addr)
+		return;
+
+	now   = (uint32_t)io_loop_now();
+	entry = __entry(addr, now);
+
+	entry->stamp = now;
+	entry->conns++;
+}
+
+void ratelimit_release(uint32_t addr)
+{
+	ratelimit_set_t *set = NULL;
+	int i = 0;
+
+	if (!table || !addr)
+		return;
+
+	set = __set(addr);
+	for (i = 0; i < RATELIMIT_WAYS; i++) {
+		if (set->way[i].addr == addr) {
+			if (set->way[i].conns)
+				set->way[i].conns--;
+			return;
+		}
+	}
+}
@@ -0,0 +1,52 @@
+/*
+ * ratelimit.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef RATELIMIT_H_
+#define RATELIMIT_H_
+
+#include <stdint.h>
+
+#define RATELIMIT_BITS 12	//!< 4096 sets per worker
+#define RATELIMIT_SETS (1 << RATELIMIT_BITS)
+#define RATELIMIT_WAYS 4		//!< entries of a set, one cache line
+#define RATELIMIT_MAX_BURST 1000000
+
+/*
+ * Per source address admission control: a token bucket for the accept
+ * rate and a cap on concurrent bridges. Every worker keeps its own
+ * table and enforces its share of the limits, SO_REUSEPORT spreads the
+ * connections of a source over the workers. The table is set
+ * associative: a source hashes to one cache line of entries and takes
+ * the coldest one with no bridges left when its set is full.
+ */
+typedef enum ratelimit_verdict_type
+{
+	RATELIMIT_PASS = 0,
+	RATELIMIT_RATE,		//!< out of tokens
+	RATELIMIT_CONNS		//!< too many bridges
+} ratelimit_verdict_t;
+
+/* process wide, before the workers start; 0 - no limit */
+void ratelimit_init(uint32_t rate, uint32_t burst, uint32_t conns, int workers);
+
+/* worker side table, attached on start and freed on exit */
+int  ratelimit_attach(void);
+void ratelimit_detach(void);
+
+/* the worker limits anything, admit() needs the source address */
+int  ratelimit_enabled(void);
+
+/* a connection from addr (network byte order) was accepted, counts it on pass */
+ratelimit_verdict_t ratelimit_admit(uint32_t addr);
+
+/* a bridge from addr taken over from the old process on upgrade, counted without a verdict */
+void ratelimit_adopt(uint32_t addr);
+
+/* an admitted connection is gone */
+void ratelimit_release(uint32_t addr);
+
+#endif /* RATELIMIT_H_ */
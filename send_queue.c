@@ -10,8 +10,33 @@
 #include <string.h>
 
 #include "send_queue.h"
+#include "buf_pool.h"
 #include "sp.h"
 #include "logger.h"
+#include "stats.h"
+#include "budget.h"
+
+/* what an sp object really takes, header included */
+#define SP_RESIDENT(ptr) (sp_getsize(ptr) + OFFSET)
+
+/* every change of the queued bytes goes through here, the global budget follows it */
+static void __queue_size_add(send_queue_t *this, size_t len)
+{
+	budget_account(this->size, this->size + len);
+	this->size += len;
+}
+
+static void __queue_size_sub(send_queue_t *this, size_t len)
+{
+	budget_account(this->size, this->size - len);
+	this->size -= len;
+}
+
+static void __queue_buf_put(void *buf)
+{
+	STATS_SUB(resident, SP_RESIDENT(buf));
+	buf_pool_put(buf);
+}
 
 static void __queue_destroy(void *ptr)
 {
@@ -24,17 +49,34 @@ static void __queue_destroy(void *ptr)
 
 	while (!queue_del_first(queue))
 		;
+
+	if (queue->spare)
+		__queue_buf_put(queue->spare);
+
+	if (queue->ring) {
+		__queue_size_sub(queue, queue->size);
+		__queue_buf_put(queue->ring);
+	}
+
+	STATS_SUB(resident, SP_RESIDENT(queue));
 }
 
-static void __queue_node_destroy(void *ptr)
+static send_queue_node_t *__queue_node_get(size_t len)
 {
-	send_queue_node_t *node = (send_queue_node_t*)ptr;
+	send_queue_node_t *node = buf_pool_get(sizeof(send_queue_node_t) + len);
 	if (!node)
-		return;
+		return NULL;
 
-	LOGGER_DBG( "%s: %p\n", __FUNCTION__, node);
+	STATS_ADD(resident, SP_RESIDENT(node));
 
-	sp_free(node->buf);
+	node->buf     = (char*)(node + 1);
+	node->cap     = sp_getsize(node) - sizeof(send_queue_node_t);
+	node->len     = 0;
+	node->drained = 0;
+	node->zc_lo   = 0;
+	node->zc_refs = 0;
+
+	return node;
 }
 
 send_queue_t *queue_create(size_t max_size)
@@ -46,6 +88,8 @@ send_queue_t *queue_create(size_t max_size)
 		if (!rc)
 			break;
 
+		STATS_ADD(resident, SP_RESIDENT(rc));
+
 		rc->size     = 0;
 		rc->max_size = max_size;
 		TAILQ_INIT(&rc->head);
@@ -59,6 +103,58 @@ send_queue_t *queue_create(size_t max_size)
 	return NULL;
 }
 
+send_queue_t *queue_create_ring(size_t capacity)
+{
+	send_queue_t *rc = NULL;
+
+	do {
+		if (!capacity)
+			break;
+
+		rc = queue_create(capacity);
+		if (!rc)
+			break;
+
+		rc->ring = buf_pool_get(capacity);
+		if (!rc->ring)
+			break;
+
+		STATS_ADD(resident, SP_RESIDENT(rc->ring));
+
+		return rc;
+	} while(0);
+
+	if (rc)
+		sp_free(rc);
+
+	return NULL;
+}
+
+/* ring mode: offset where the next byte goes */
+static size_t __ring_wpos(send_queue_t *this)
+{
+	return (this->rpos + this->size) % this->max_size;
+}
+
+static int __ring_enqueue(send_queue_t *this, char *buf, size_t len)
+{
+	size_t wpos  = __ring_wpos(this);
+	size_t first = this->max_size - wpos;
+
+	if (len > this->max_size - this->size)
+		return -1;
+
+	if (first > len)
+		first = len;
+
+	memcpy(this->ring + wpos, buf, first);
+	memcpy(this->ring, buf + first, len - first);
+
+	__queue_size_add(this, len);
+
+	return 0;
+}
+
 int queue_enqueue(send_queue_t *this, char *buf, size_t len)
 {
 	int rc = -1;
@@ -71,27 +167,24 @@ int queue_enqueue(send_queue_t *this, char *buf, size_t len)
 		if (!buf || !len)
 			break;
 
-		node = sp_t_calloc(sizeof(send_queue_node_t), __queue_node_destroy, "send_queue_node_t");
-		if (!node)
+		if (this->ring) {
+			rc = __ring_enqueue(this, buf, len);
 			break;
+		}
 
-		node->buf = sp_malloc(len);
-		if (!node->buf)
+		node = __queue_node_get(len);
+		if (!node)
 			break;
 
-		node->drained = 0;
-		node->len     = len;
+		node->len = len;
 		memcpy(node->buf, buf, len);
 
-		this->size += len;
+		__queue_size_add(this, len);
 
 		TAILQ_INSERT_TAIL(&this->head, node, list);
 		rc = 0;
 	} while(0);
 
-	if (rc && node)
-		sp_free(node);
-
 	LOGGER_DBG( "___%s: this {%p} len {%d}, result {%s}\n", __FUNCTION__, this, len, (rc)?"error":"ok");
 
 	return rc;
@@ -99,13 +192,17 @@ int queue_enqueue(send_queue_t *this, char *buf, size_t len)
 
 int queue_is_empty(send_queue_t *this)
 {
-	int rc = 0;
+	int rc = 1;
 
 	do {
+		/* queues are created on the first read, none yet is an empty one */
 		if (!this)
 			break;
 
-		if (TAILQ_EMPTY(&this->head))
+		rc = 0;
+		if (this->ring)
+			rc = !this->size;
+		else if (TAILQ_EMPTY(&this->head))
 			rc++;
 	} while(0);
 
@@ -136,10 +233,11 @@ send_queue_node_t * queue_get_first(send_queue_t *this)
 
 	LOGGER_DBG( "___%s: this\n", __FUNCTION__, this);
 
-	if (!this)
+	if (!this || this->ring)
 		return NULL;
 
-	node = sp_dup(TAILQ_FIRST(&this->head));
+	/* borrowed, the node stays owned by the queue */
+	node = TAILQ_FIRST(&this->head);
 
 	LOGGER_DBG( "___%s: this {%p}, result {%p}\n", __FUNCTION__, this, node);
 
@@ -153,7 +251,7 @@ int queue_del_first(send_queue_t *this)
 	LOGGER_DBG( "___%s: this {%p}\n", __FUNCTION__, this);
 
 	do {
-		if (!this)
+		if (!this || this->ring)
 			break;
 
 		send_queue_node_t *node = (send_queue_node_t*)TAILQ_FIRST(&this->head);
@@ -162,11 +260,257 @@ int queue_del_first(send_queue_t *this)
 
 		TAILQ_REMOVE(&this->head, node, list);
 
-		this->size -= node->len;
+		__queue_size_sub(this, node->len);
 
-		sp_free(node);
+		__queue_buf_put(node);
 		rc = 0;
 	} while(0);
 
 	return rc;
 }
+
+send_queue_node_t *queue_detach_first(send_queue_t *this)
+{
+	send_queue_node_t *node = NULL;
+
+	if (!this || this->ring)
+		return NULL;
+
+	node = TAILQ_FIRST(&this->head);
+	if (!node)
+		return NULL;
+
+	TAILQ_REMOVE(&this->head, node, list);
+	__queue_size_sub(this, node->len);
+
+	return node;
+}
+
+void queue_node_release(send_queue_node_t *node)
+{
+	if (node)
+		__queue_buf_put(node);
+}
+
+int queue_fill_iov(send_queue_t *this, struct iovec *iov, int max, int *more)
+{
+	send_queue_node_t *node = NULL;
+	int cnt = 0;
+
+	if (more)
+		*more = 0;
+
+	if (!this || !iov || max <= 0)
+		return 0;
+
+	if (this->ring) {
+		size_t first = this->max_size - this->rpos;
+
+		if (!this->size)
+			return 0;
+
+		if (first > this->size)
+			first = this->size;
+
+		iov[cnt].iov_base = this->ring + this->rpos;
+		iov[cnt].iov_len  = first;
+		cnt++;
+
+		if (first < this->size) {
+			if (cnt == max) {
+				if (more)
+					*more = 1;
+				return cnt;
+			}
+
+			iov[cnt].iov_base = this->ring;
+			iov[cnt].iov_len  = this->size - first;
+			cnt++;
+		}
+
+		return cnt;
+	}
+
+	TAILQ_FOREACH(node, &this->head, list) {
+		if (cnt == max) {
+			if (more)
+				*more = 1;
+			break;
+		}
+
+		iov[cnt].iov_base = node->buf + node->drained;
+		iov[cnt].iov_len  = node->len - node->drained;
+		cnt++;
+	}
+
+	return cnt;
+}
+
+size_t queue_copy(send_queue_t *this, char *buf, size_t len)
+{
+	send_queue_node_t *node = NULL;
+	size_t done = 0;
+	size_t n    = 0;
+
+	if (!this)
+		return 0;
+
+	if (this->ring) {
+		if (len > this->size)
+			len = this->size;
+
+		n = this->max_size - this->rpos;
+		if (n > len)
+			n = len;
+
+		memcpy(buf, this->ring + this->rpos, n);
+		memcpy(buf + n, this->ring, len - n);
+
+		return len;
+	}
+
+	TAILQ_FOREACH(node, &this->head, list) {
+		n = node->len - node->drained;
+		if (n > len - done)
+			n = len - done;
+
+		memcpy(buf + done, node->buf + node->drained, n);
+		done += n;
+
+		if (done == len)
+			break;
+	}
+
+	return done;
+}
+
+void queue_drain(send_queue_t *this, size_t len)
+{
+	send_queue_node_t *node = NULL;
+
+	if (this && this->ring) {
+		if (len > this->size)
+			len = this->size;
+
+		__queue_size_sub(this, len);
+		/* start over at the beginning once empty, keeps the next reads contiguous */
+		this->rpos  = (this->size) ? (this->rpos + len) % this->max_size : 0;
+		return;
+	}
+
+	while (this && len) {
+		node = TAILQ_FIRST(&this->head);
+		if (!node)
+			break;
+
+		if (len < node->len - node->drained) {
+			node->drained += len;
+			break;
+		}
+
+		len -= node->len - node->drained;
+		queue_del_first(this);
+	}
+}
+
+static int __ring_tail_iov(send_queue_t *this, size_t want, struct iovec *iov)
+{
+	size_t wpos  = __ring_wpos(this);
+	size_t room  = this->max_size - this->size;
+	size_t first = this->max_size - wpos;
+	int cnt = 0;
+
+	if (room > want)
+		room = want;
+
+	if (!room)
+		return 0;
+
+	if (first > room)
+		first = room;
+
+	iov[cnt].iov_base = this->ring + wpos;
+	iov[cnt].iov_len  = first;
+	cnt++;
+
+	if (first < room) {
+		iov[cnt].iov_base = this->ring;
+		iov[cnt].iov_len  = room - first;
+		cnt++;
+	}
+
+	return cnt;
+}
+
+int queue_tail_iov(send_queue_t *this, size_t want, struct iovec *iov)
+{
+	send_queue_node_t *node = NULL;
+	size_t len = 0;
+
+	if (!this || !want || !iov)
+		return 0;
+
+	if (this->ring)
+		return __ring_tail_iov(this, want, iov);
+
+	do {
+		/* keep filling the last node while it has room worth a syscall */
+		node = TAILQ_LAST(&this->head, queue);
+		if (node && node->cap - node->len >= QUEUE_MIN_ROOM)
+			break;
+
+		node = this->spare;
+		if (node)
+			break;
+
+		/* size the buffer after the previous read: small talk gets small buffers */
+		len = want;
+		if (this->last_read && this->last_read * 2 < len)
+			len = this->last_read * 2;
+
+		node = this->spare = __queue_node_get(len);
+	} while(0);
+
+	if (!node)
+		return 0;
+
+	iov[0].iov_base = node->buf + node->len;
+	iov[0].iov_len  = node->cap - node->len;
+	if (iov[0].iov_len > want)
+		iov[0].iov_len = want;
+
+	return 1;
+}
+
+void queue_tail_commit(send_queue_t *this, size_t len)
+{
+	send_queue_node_t *node = NULL;
+
+	if (!this)
+		return;
+
+	if (this->ring) {
+		__queue_size_add(this, len);
+		return;
+	}
+
+	/* nothing read, do not let an idle queue sit on a buffer */
+	if (!len) {
+		if (this->spare)
+			__queue_buf_put(this->spare);
+		this->spare = NULL;
+		return;
+	}
+
+	node = this->spare;
+	if (node) {
+		this->spare = NULL;
+		TAILQ_INSERT_TAIL(&this->head, node, list);
+	} else {
+		node = TAILQ_LAST(&this->head, queue);
+	}
+
+	node->len       += len;
+	this->last_read  = len;
+	__queue_size_add(this, len);
+}
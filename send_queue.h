@@ -8,12 +8,22 @@
 #ifndef SEND_QUEUE_H_
 #define SEND_QUEUE_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/queue.h>
+#include <sys/uio.h>
 
+#define QUEUE_MIN_ROOM 1024		//!< smaller tail room is not worth a read
+#define QUEUE_TAIL_IOV 2		//!< iovecs queue_tail_iov() may fill
+
+/* node and its buffer are one pooled allocation, buf points right past the node */
 typedef struct send_queue_node_type {
 	char *buf;
 	size_t len;
 	size_t drained;
+	size_t cap;
+	uint32_t zc_lo;		//!< id of the first MSG_ZEROCOPY send of the node
+	uint32_t zc_refs;	//!< MSG_ZEROCOPY sends of the node not completed yet
 	TAILQ_ENTRY(send_queue_node_type) list;
 } send_queue_node_t;
 
@@ -21,15 +31,45 @@ typedef struct send_queue_type
 {
 	size_t size;
 	size_t max_size;
+	size_t last_read;			//!< size of the last commit, picks the class of the next node
+	send_queue_node_t *spare;	//!< node handed out by queue_tail_iov(), not linked yet
 	TAILQ_HEAD(queue, send_queue_node_type) head;
+	char *ring;					//!< ring mode: contiguous buffer of max_size bytes, NULL - node list
+	size_t rpos;				//!< ring mode: offset of the first pending byte
 } send_queue_t;
 
 
 send_queue_t *queue_create(size_t max_size);
+send_queue_t *queue_create_ring(size_t capacity);
 int queue_enqueue(send_queue_t *this, char *buf, size_t len);
 int queue_is_empty(send_queue_t *this);
 int queue_is_full(send_queue_t *this);
+/* node list only, a ring has no nodes */
 send_queue_node_t * queue_get_first(send_queue_t *this);
 int queue_del_first(send_queue_t *this);
 
+/* unlink the first node without releasing it, queue_node_release() it later */
+send_queue_node_t *queue_detach_first(send_queue_t *this);
+void queue_node_release(send_queue_node_t *node);
+
+/*
+ * Gather send: describe up to max pending nodes in iov, *more is set
+ * when nodes are left out. queue_drain() consumes len sent bytes,
+ * walking a partial write across nodes.
+ */
+int queue_fill_iov(send_queue_t *this, struct iovec *iov, int max, int *more);
+void queue_drain(send_queue_t *this, size_t len);
+
+/* copy out up to len pending bytes without consuming them, returns how many */
+size_t queue_copy(send_queue_t *this, char *buf, size_t len);
+
+/*
+ * Receive without a copy: fill up to QUEUE_TAIL_IOV iovecs with at most
+ * want bytes of free room, readv() into them, then commit what was
+ * actually read to append it to the queue. Returns 0 when the queue is
+ * full or out of memory. Committing 0 gives an unused buffer back to the pool.
+ */
+int queue_tail_iov(send_queue_t *this, size_t want, struct iovec *iov);
+void queue_tail_commit(send_queue_t *this, size_t len);
+
 #endif /* SEND_QUEUE_H_ */
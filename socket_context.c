@@ -63,3 +63,77 @@ void context_set_peer(ctx_t *ctx, ctx_t *peer)
 
 	ctx->peer = peer;
 }
+
+static void __unlink(ctx_t *ctx)
+{
+	TAILQ_REMOVE(&ctx->list->head, ctx, link);
+	ctx->list->length--;
+	ctx->list = NULL;
+}
+
+static void __ctx_list_destroy(void *ptr)
+{
+	ctx_list_t *obj = (ctx_list_t*)ptr;
+	ctx_t *ctx = NULL;
+
+	if (!obj)
+		return;
+
+	while ((ctx = TAILQ_FIRST(&obj->head))) {
+		__unlink(ctx);
+		sp_free(ctx);
+	}
+}
+
+ctx_list_t *context_list_new(void)
+{
+	ctx_list_t *rc = sp_t_calloc(sizeof(ctx_list_t), __ctx_list_destroy, "_ctx_list_t_");
+
+	if (rc)
+		TAILQ_INIT(&rc->head);
+
+	return rc;
+}
+
+void context_list_put(ctx_list_t *list, ctx_t *ctx)
+{
+	if (!list || !ctx || ctx->list == list)
+		return;
+
+	if (ctx->list)
+		__unlink(ctx);
+	else
+		sp_dup(ctx);
+
+	TAILQ_INSERT_TAIL(&list->head, ctx, link);
+	list->length++;
+	ctx->list = list;
+}
+
+int context_list_remove(ctx_list_t *list, ctx_t *ctx)
+{
+	if (!list || !ctx || ctx->list != list)
+		return -1;
+
+	__unlink(ctx);
+	sp_free(ctx);
+
+	return 0;
+}
+
+int context_list_iterate(ctx_list_t *list, context_cb f, void *arg)
+{
+	ctx_t *ctx = NULL;
+	int rc = 0;
+
+	if (!list)
+		return 0;
+
+	TAILQ_FOREACH(ctx, &list->head, link) {
+		rc = f(arg, ctx);
+		if (rc)
+			break;
+	}
+
+	return rc;
+}
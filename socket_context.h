@@ -8,6 +8,9 @@
 #ifndef SOCKET_CONTEXT_H_
 #define SOCKET_CONTEXT_H_
 
+#include <stddef.h>
+#include <sys/queue.h>
+
 typedef void (*destroy_cb)(void*);
 
 typedef enum context_type {
@@ -26,15 +29,43 @@ static const char * const type_str[TYPES_NUM] = {
 struct context_struct;
 typedef struct context_struct ctx_t;
 
+struct context_list_type;
+typedef struct context_list_type ctx_list_t;
+
 struct context_struct {
 	int          fd;
 	ctx_type_t   type;
 	void        *data;
 	destroy_cb   cb;
 	ctx_t       *peer;
+	TAILQ_ENTRY(context_struct) link;	//!< position in its list
+	ctx_list_t  *list;		//!< NULL - in no list
 };
 
+/*
+ * Intrusive list of contexts, one per bridge state: the links live in
+ * ctx_t, a context is in one list at most. Like the maps it replaces
+ * a list keeps a reference: put takes one, remove and the destructor
+ * (sp_free() of the list) drop it. Putting a context that is in
+ * another list moves it over with its reference, all of it in O(1).
+ * Contexts go to the tail, a list is in the order they entered it.
+ */
+struct context_list_type {
+	TAILQ_HEAD(context_head, context_struct) head;
+	size_t length;
+};
+
+/* f(arg, ctx) for every context until it returns non zero, f must not change the list */
+typedef int (*context_cb)(void *arg, ctx_t *ctx);
+
 ctx_t *context_create(int fd, ctx_type_t type, void *data, destroy_cb);
 void context_set_peer(ctx_t *ctx, ctx_t *peer);
 
+ctx_list_t *context_list_new(void);
+void context_list_put(ctx_list_t *list, ctx_t *ctx);
+
+/* 0 or -1 if ctx is not in list, ctx may be gone once it returns */
+int  context_list_remove(ctx_list_t *list, ctx_t *ctx);
+int  context_list_iterate(ctx_list_t *list, context_cb f, void *arg);
+
 #endif /* SOCKET_CONTEXT_H_ */
@@ -9,9 +9,15 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <linux/tcp.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <string.h>
 
 #include "socket_utils.h"
 
+#define TCPI_SYN_SENT 2	//!< TCP_SYN_SENT, netinet/tcp.h does not mix with linux/tcp.h
+
 int configure_socket(int fd) {
 	int enable = 1;
 	int rc = -1;
@@ -28,3 +34,85 @@ int configure_socket(int fd) {
 
 	return rc;
 }
+
+size_t socket_bdp(int fd)
+{
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	uint64_t bdp  = 0;
+	uint64_t cwnd = 0;
+
+	memset(&info, 0, sizeof(info));
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+		return 0;
+
+	/* delivery_rate is bytes per second, rtt is in usec */
+	if (len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate))
+		bdp = info.tcpi_delivery_rate * info.tcpi_rtt / 1000000;
+
+	/* app limited or old kernel: what the congestion window allows in flight */
+	cwnd = (uint64_t)info.tcpi_snd_cwnd * info.tcpi_snd_mss;
+	if (cwnd > bdp)
+		bdp = cwnd;
+
+	return (size_t)bdp;
+}
+
+int socket_unsent(int fd)
+{
+	int n = 0;
+
+	if (ioctl(fd, SIOCOUTQNSD, &n) < 0)
+		return 0;
+
+	return n;
+}
+
+uint64_t socket_idle(int fd)
+{
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	memset(&info, 0, sizeof(info));
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+		return UINT64_MAX;
+
+	return info.tcpi_last_data_recv;
+}
+
+int socket_fastopen(int fd)
+{
+	int enable = 1;
+
+	return setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enable, sizeof(enable));
+}
+
+int socket_syn_data(int fd)
+{
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+
+	memset(&info, 0, sizeof(info));
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0 || TCPI_SYN_SENT == info.tcpi_state)
+		return -1;
+
+	return !!(info.tcpi_options & TCPI_OPT_SYN_DATA);
+}
+
+int socket_abort(int fd)
+{
+	struct linger lg = { 1, 0 };
+
+	return setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+}
+
+int socket_peek(int fd)
+{
+	char c = 0;
+	ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+	if (n < 0)
+		return -1;
+
+	return (n) ? 1 : 0;
+}
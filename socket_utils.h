@@ -8,6 +8,30 @@
 #ifndef SOCKET_UTILS_H_
 #define SOCKET_UTILS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 int configure_socket(int fd);
 
+/* bandwidth-delay product of a connected TCP socket from TCP_INFO, 0 if unknown */
+size_t socket_bdp(int fd);
+
+/* bytes in the send queue not sent yet (SIOCOUTQNSD), 0 on error */
+int socket_unsent(int fd);
+
+/* ms since the last data received on a TCP socket, UINT64_MAX if unknown */
+uint64_t socket_idle(int fd);
+
+/* SO_LINGER 0: close() sends RST and leaves no TIME_WAIT */
+int socket_abort(int fd);
+
+/* 1 if data waits to be read, 0 on EOF, -1 if nothing yet or on error */
+int socket_peek(int fd);
+
+/* TCP_FASTOPEN_CONNECT, before connect() */
+int socket_fastopen(int fd);
+
+/* once the handshake is over: 1 if the server acked data sent in the SYN, 0 if not; -1 before */
+int socket_syn_data(int fd);
+
 #endif /* SOCKET_UTILS_H_ */
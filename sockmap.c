@@ -0,0 +1,236 @@
+/*
+ * sockmap.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/bpf.h>
+#include <linux/sockios.h>
+
+#include "sockmap.h"
+#include "logger.h"
+
+/* sk_skb verdicts */
+#define SK_DROP 0
+#define SK_PASS 1
+
+#define INSN(c, d, s, o, i) \
+	((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+
+/* the fields of struct __sk_buff in the order the program stores them */
+typedef struct sockmap_key_type
+{
+	uint32_t remote_ip4;
+	uint32_t local_ip4;
+	uint32_t remote_port;	//!< network byte order, in the upper half on little endian
+	uint32_t local_port;	//!< host byte order
+} sockmap_key_t;
+
+static int map_fd  = -1;
+static int prog_fd = -1;
+
+static long sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * r6 = ctx
+ * a bare FIN has no data, sending or queueing 0 bytes is taken for a
+ * broken pipe by the psock backlog. It is dropped, the socket has its
+ * RCV_SHUTDOWN already and userspace reads EOF as usual
+ * key = { remote_ip4, local_ip4, remote_port, local_port } on the stack
+ * r0 = bpf_sk_redirect_hash(ctx, map, &key, 0)  - egress of the peer
+ * return r0 == SK_DROP ? SK_PASS : r0            - no peer, keep the data
+ */
+static int __prog_load(void)
+{
+	struct bpf_insn prog[] = {
+		INSN(BPF_ALU64 | BPF_MOV | BPF_X,  BPF_REG_6,  BPF_REG_1, 0, 0),
+		INSN(BPF_LDX   | BPF_MEM | BPF_W,  BPF_REG_2,  BPF_REG_6, offsetof(struct __sk_buff, len), 0),
+		INSN(BPF_JMP   | BPF_JNE | BPF_K,  BPF_REG_2,  0, 2, 0),
+		INSN(BPF_ALU64 | BPF_MOV | BPF_K,  BPF_REG_0,  0, 0, SK_DROP),
+		INSN(BPF_JMP   | BPF_EXIT,         0, 0, 0, 0),
+		INSN(BPF_LDX   | BPF_MEM | BPF_W,  BPF_REG_2,  BPF_REG_6, offsetof(struct __sk_buff, remote_ip4), 0),
+		INSN(BPF_STX   | BPF_MEM | BPF_W,  BPF_REG_10, BPF_REG_2, -16, 0),
+		INSN(BPF_LDX   | BPF_MEM | BPF_W,  BPF_REG_2,  BPF_REG_6, offsetof(struct __sk_buff, local_ip4), 0),
+		INSN(BPF_STX   | BPF_MEM | BPF_W,  BPF_REG_10, BPF_REG_2, -12, 0),
+		INSN(BPF_LDX   | BPF_MEM | BPF_W,  BPF_REG_2,  BPF_REG_6, offsetof(struct __sk_buff, remote_port), 0),
+		INSN(BPF_STX   | BPF_MEM | BPF_W,  BPF_REG_10, BPF_REG_2, -8, 0),
+		INSN(BPF_LDX   | BPF_MEM | BPF_W,  BPF_REG_2,  BPF_REG_6, offsetof(struct __sk_buff, local_port), 0),
+		INSN(BPF_STX   | BPF_MEM | BPF_W,  BPF_REG_10, BPF_REG_2, -4, 0),
+		INSN(BPF_ALU64 | BPF_MOV | BPF_X,  BPF_REG_1,  BPF_REG_6, 0, 0),
+		INSN(BPF_LD    | BPF_DW  | BPF_IMM, BPF_REG_2, BPF_PSEUDO_MAP_FD, 0, map_fd),
+		INSN(0, 0, 0, 0, 0),
+		INSN(BPF_ALU64 | BPF_MOV | BPF_X,  BPF_REG_3,  BPF_REG_10, 0, 0),
+		INSN(BPF_ALU64 | BPF_ADD | BPF_K,  BPF_REG_3,  0, 0, -16),
+		INSN(BPF_ALU64 | BPF_MOV | BPF_K,  BPF_REG_4,  0, 0, 0),
+		INSN(BPF_JMP   | BPF_CALL,         0, 0, 0, BPF_FUNC_sk_redirect_hash),
+		INSN(BPF_JMP   | BPF_JNE | BPF_K,  BPF_REG_0,  0, 1, SK_DROP),
+		INSN(BPF_ALU64 | BPF_MOV | BPF_K,  BPF_REG_0,  0, 0, SK_PASS),
+		INSN(BPF_JMP   | BPF_EXIT,         0, 0, 0, 0),
+	};
+
+	static const char license[] = "GPL";
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+	attr.insns     = (uint64_t)(uintptr_t)prog;
+	attr.insn_cnt  = sizeof(prog) / sizeof(prog[0]);
+	attr.license   = (uint64_t)(uintptr_t)license;
+
+	return (int)sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+int sockmap_init(void)
+{
+	union bpf_attr attr;
+	int rc = -1;
+
+	do {
+		memset(&attr, 0, sizeof(attr));
+		attr.map_type    = BPF_MAP_TYPE_SOCKHASH;
+		attr.key_size    = sizeof(sockmap_key_t);
+		attr.value_size  = sizeof(uint32_t);
+		attr.max_entries = SOCKMAP_SIZE;
+
+		map_fd = (int)sys_bpf(BPF_MAP_CREATE, &attr);
+		if (map_fd < 0) {
+			LOGGER_ERR("failed to create sockhash: %s\n", strerror(errno));
+			break;
+		}
+
+		prog_fd = __prog_load();
+		if (prog_fd < 0) {
+			LOGGER_ERR("failed to load sk_skb verdict program: %s\n", strerror(errno));
+			break;
+		}
+
+		memset(&attr, 0, sizeof(attr));
+		attr.target_fd     = map_fd;
+		attr.attach_bpf_fd = prog_fd;
+		attr.attach_type   = BPF_SK_SKB_VERDICT;
+
+		if (sys_bpf(BPF_PROG_ATTACH, &attr) < 0) {
+			LOGGER_ERR("failed to attach verdict program: %s\n", strerror(errno));
+			break;
+		}
+
+		rc = 0;
+	} while(0);
+
+	if (rc < 0) {
+		if (prog_fd >= 0)
+			close(prog_fd);
+		if (map_fd >= 0)
+			close(map_fd);
+		prog_fd = map_fd = -1;
+	}
+
+	return rc;
+}
+
+/* the key the program builds from an skb received on peer_fd */
+static int __key(int peer_fd, sockmap_key_t *key)
+{
+	struct sockaddr_in local;
+	struct sockaddr_in remote;
+	socklen_t len = sizeof(local);
+
+	if (getsockname(peer_fd, (struct sockaddr *)&local, &len) < 0)
+		return -1;
+
+	len = sizeof(remote);
+	if (getpeername(peer_fd, (struct sockaddr *)&remote, &len) < 0)
+		return -1;
+
+	memset(key, 0, sizeof(*key));
+	key->remote_ip4 = remote.sin_addr.s_addr;
+	key->local_ip4  = local.sin_addr.s_addr;
+	key->local_port = ntohs(local.sin_port);
+
+	/* the kernel loads skc_dport as is and shifts it up on little endian */
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	key->remote_port = (uint32_t)remote.sin_port << 16;
+#else
+	key->remote_port = remote.sin_port;
+#endif
+
+	return 0;
+}
+
+int sockmap_add(int fd, int peer_fd)
+{
+	union bpf_attr attr;
+	sockmap_key_t key;
+	uint32_t value = (uint32_t)fd;
+
+	if (map_fd < 0 || __key(peer_fd, &key) < 0)
+		return -1;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key    = (uint64_t)(uintptr_t)&key;
+	attr.value  = (uint64_t)(uintptr_t)&value;
+	attr.flags  = BPF_NOEXIST;
+
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+		LOGGER_DBG( "sockhash update for fd {%d} failed: %s\n", fd, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int sockmap_del(int fd, int peer_fd)
+{
+	union bpf_attr attr;
+	sockmap_key_t key;
+
+	if (map_fd < 0 || __key(peer_fd, &key) < 0)
+		return -1;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key    = (uint64_t)(uintptr_t)&key;
+
+	if (sys_bpf(BPF_MAP_DELETE_ELEM, &attr) < 0) {
+		LOGGER_DBG( "sockhash delete for fd {%d} failed: %s\n", fd, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int sockmap_unread(int fd)
+{
+	int n = 0;
+
+	if (ioctl(fd, SIOCINQ, &n) < 0)
+		return -1;
+
+	return n;
+}
+
+int sockmap_unsent(int fd)
+{
+	int n = 0;
+
+	if (ioctl(fd, SIOCOUTQ, &n) < 0)
+		return -1;
+
+	return n;
+}
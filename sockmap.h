@@ -0,0 +1,38 @@
+/*
+ * sockmap.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef SOCKMAP_H_
+#define SOCKMAP_H_
+
+#define SOCKMAP_SIZE         65536	//!< sockets in the map, two per offloaded bridge
+#define SOCKMAP_DRAIN_MS     10		//!< period of the send queue check before a FIN
+#define SOCKMAP_DRAIN_SAMPLES 2		//!< empty send queue samples in a row before a FIN
+
+/*
+ * In-kernel forwarding of established bridges. A BPF_MAP_TYPE_SOCKHASH
+ * with an sk_skb verdict program attached: data received on a socket of
+ * the map is redirected straight to the send path of its peer, no
+ * wakeup and no copy through userspace. A socket is stored under the
+ * 4-tuple of its peer as the program sees it, so the lookup key is
+ * built from the skb alone. When the peer is missing the data passes
+ * to the socket itself and userspace forwards it as usual.
+ */
+
+/* process wide, before the workers start; -1 if BPF is not available */
+int  sockmap_init(void);
+
+/* add fd so that data received on peer_fd goes to fd */
+int  sockmap_add(int fd, int peer_fd);
+int  sockmap_del(int fd, int peer_fd);
+
+/* bytes received on fd that userspace has not read */
+int  sockmap_unread(int fd);
+
+/* bytes in the send queue of fd, sent or not */
+int  sockmap_unsent(int fd);
+
+#endif /* SOCKMAP_H_ */
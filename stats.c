@@ -0,0 +1,177 @@
+/*
+ * stats.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "stats.h"
+#include "sp.h"
+#include "logger.h"
+
+__thread stats_t *stats_local = NULL;
+
+static stats_t *stats_table = NULL;
+static int stats_workers = 0;
+
+typedef struct stats_field_type
+{
+	const char *name;
+	size_t offset;
+} stats_field_t;
+
+#define STATS_FIELD(f) { #f, offsetof(stats_t, f) }
+
+static const stats_field_t stats_fields[] = {
+	STATS_FIELD(accepted),
+	STATS_FIELD(connected),
+	STATS_FIELD(connect_failed),
+	STATS_FIELD(fastopen_sent),
+	STATS_FIELD(fastopen_fallbacks),
+	STATS_FIELD(closed),
+	STATS_FIELD(aborted),
+	STATS_FIELD(active),
+	STATS_FIELD(stopping),
+	STATS_FIELD(lazy),
+	STATS_FIELD(lazy_closed),
+	STATS_FIELD(limited_rate),
+	STATS_FIELD(limited_conns),
+	STATS_FIELD(ratelimit_evictions),
+	STATS_FIELD(resident),
+	STATS_FIELD(budget_queued),
+	STATS_FIELD(budget_paused),
+	STATS_FIELD(budget_pauses),
+	STATS_FIELD(budget_pause_ms),
+	STATS_FIELD(breaker_trips),
+	STATS_FIELD(breaker_rejects),
+	STATS_FIELD(handed_over),
+	STATS_FIELD(taken_over),
+	STATS_FIELD(connect_timeouts),
+	STATS_FIELD(idle_timeouts),
+	STATS_FIELD(stopping_timeouts),
+	STATS_FIELD(bytes_cli),
+	STATS_FIELD(bytes_srv),
+	STATS_FIELD(epoll_waits),
+	STATS_FIELD(epoll_ctls),
+	STATS_FIELD(reads),
+	STATS_FIELD(writes),
+	STATS_FIELD(uring_enters),
+	STATS_FIELD(uring_sqes),
+	STATS_FIELD(uring_recvs),
+	STATS_FIELD(uring_sends),
+	STATS_FIELD(uring_accepts),
+	STATS_FIELD(splices),
+	STATS_FIELD(pipes_created),
+	STATS_FIELD(bufs_allocated),
+	STATS_FIELD(zc_sends),
+	STATS_FIELD(zc_completed),
+	STATS_FIELD(zc_copied),
+	STATS_FIELD(sockmap_offloads),
+	STATS_FIELD(sockmap_fails),
+	{ "qsize<=16k", offsetof(stats_t, qsize[0]) },
+	{ "qsize<=32k", offsetof(stats_t, qsize[1]) },
+	{ "qsize<=64k", offsetof(stats_t, qsize[2]) },
+	{ "qsize<=128k", offsetof(stats_t, qsize[3]) },
+	{ "qsize<=256k", offsetof(stats_t, qsize[4]) },
+	{ "qsize<=512k", offsetof(stats_t, qsize[5]) },
+	{ "qsize<=1m", offsetof(stats_t, qsize[6]) },
+	{ "qsize<=2m", offsetof(stats_t, qsize[7]) },
+	{ "qsize<=4m", offsetof(stats_t, qsize[8]) },
+	{ "qsize>4m", offsetof(stats_t, qsize[9]) },
+};
+
+#define STATS_FIELDS_NUM (sizeof(stats_fields) / sizeof(stats_fields[0]))
+
+static uint64_t stats_get(stats_t *s, size_t offset)
+{
+	return __atomic_load_n((uint64_t*)((char*)s + offset), __ATOMIC_RELAXED);
+}
+
+int stats_init(int workers)
+{
+	int rc = -1;
+
+	do {
+		if (workers <= 0 || stats_table)
+			break;
+
+		stats_table = sp_t_calloc(workers * sizeof(stats_t), NULL, "_stats_t_");
+		if (!stats_table)
+			break;
+
+		stats_workers = workers;
+
+		rc = 0;
+	} while(0);
+
+	return rc;
+}
+
+void stats_attach(int worker)
+{
+	if (!stats_table || worker < 0 || worker >= stats_workers)
+		return;
+
+	stats_local = &stats_table[worker];
+}
+
+void stats_qsize(size_t size)
+{
+	int bucket = 0;
+	size_t limit = 16 * 1024;
+
+	while (bucket < QSIZE_BUCKETS - 1 && size > limit) {
+		limit <<= 1;
+		bucket++;
+	}
+
+	STATS_INC(qsize[bucket]);
+}
+
+void stats_dump(FILE *out)
+{
+	size_t f = 0;
+	int w = 0;
+
+	if (!stats_table || !out)
+		return;
+
+	fprintf(out, "%-20s", "stats");
+	for (w = 0; w < stats_workers; w++)
+		fprintf(out, " %12s%-3d", "worker#", w);
+	fprintf(out, " %15s\n", "total");
+
+	for (f = 0; f < STATS_FIELDS_NUM; f++) {
+		uint64_t total = 0;
+
+		fprintf(out, "%-20s", stats_fields[f].name);
+		for (w = 0; w < stats_workers; w++) {
+			uint64_t v = stats_get(&stats_table[w], stats_fields[f].offset);
+			total += v;
+			fprintf(out, " %15"PRIu64, v);
+		}
+		fprintf(out, " %15"PRIu64"\n", total);
+	}
+
+	/* what an open bridge costs on average, idle ones should stay near sizeof(bridge_t) */
+	{
+		uint64_t resident = 0;
+		uint64_t bridges  = 0;
+
+		fprintf(out, "%-20s", "resident/bridge");
+		for (w = 0; w < stats_workers; w++) {
+			uint64_t r = stats_get(&stats_table[w], offsetof(stats_t, resident));
+			uint64_t b = stats_get(&stats_table[w], offsetof(stats_t, active)) +
+			             stats_get(&stats_table[w], offsetof(stats_t, stopping));
+			resident += r;
+			bridges  += b;
+			fprintf(out, " %15"PRIu64, (b) ? r / b : 0);
+		}
+		fprintf(out, " %15"PRIu64"\n", (bridges) ? resident / bridges : 0);
+	}
+
+	fflush(out);
+}
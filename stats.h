@@ -0,0 +1,91 @@
+/*
+ * stats.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define QSIZE_BUCKETS 10	//!< <=16k, <=32k ... <=4m, >4m
+
+/*
+ * Every worker owns one stats_t slot and is the only writer to it,
+ * so updates are plain relaxed stores. Readers (stats_dump) may run
+ * on any thread and see a slightly stale but never torn value.
+ */
+typedef struct stats_type
+{
+	uint64_t accepted;			//!< connections accepted by the listener
+	uint64_t connected;			//!< upstream connects completed
+	uint64_t connect_failed;	//!< upstream connects failed
+	uint64_t fastopen_sent;		//!< upstream SYNs that carried client data the server accepted
+	uint64_t fastopen_fallbacks;	//!< fastopen connects without client data in the SYN: no cookie, refused or a silent client
+	uint64_t closed;			//!< bridges destroyed
+	uint64_t aborted;			//!< of those closed with RST: errors and timeouts
+	uint64_t active;			//!< bridges in BRIDGE_CONNECTING/BRIDGE_ACTIVE (gauge)
+	uint64_t stopping;			//!< bridges in BRIDGE_STOPPING (gauge)
+	uint64_t lazy;				//!< bridges waiting for client data, no upstream yet (gauge)
+	uint64_t lazy_closed;		//!< bridges closed before the client sent anything, upstream never opened
+	uint64_t limited_rate;		//!< connections reset, their source was over --rate-limit
+	uint64_t limited_conns;		//!< connections reset, their source was at --conn-limit
+	uint64_t ratelimit_evictions;	//!< sources that lost their table entry to a new one
+	uint64_t resident;			//!< bytes held by bridges, their queues and queue buffers (gauge)
+	uint64_t budget_queued;		//!< bytes queued, counted against --budget (gauge)
+	uint64_t budget_paused;		//!< bridge directions with reads paused by the budget (gauge)
+	uint64_t budget_pauses;		//!< reads paused by the budget
+	uint64_t budget_pause_ms;	//!< total time reads stayed paused by the budget
+	uint64_t breaker_trips;		//!< destinations found down, their breaker opened
+	uint64_t breaker_rejects;	//!< clients reset without a connect, their destination was down
+	uint64_t handed_over;		//!< bridges handed over to a new binary on upgrade
+	uint64_t taken_over;		//!< bridges taken over from the old binary on upgrade
+	uint64_t connect_timeouts;	//!< bridges dropped by the connect timer
+	uint64_t idle_timeouts;		//!< bridges dropped by the idle timer
+	uint64_t stopping_timeouts;	//!< bridges dropped by the stopping timer
+	uint64_t bytes_cli;			//!< bytes read from clients
+	uint64_t bytes_srv;			//!< bytes read from servers
+	uint64_t epoll_waits;		//!< epoll_wait() calls
+	uint64_t epoll_ctls;		//!< epoll_ctl() calls
+	uint64_t reads;				//!< read() calls on bridge sockets
+	uint64_t writes;			//!< write() calls on bridge sockets
+	uint64_t uring_enters;		//!< io_uring_enter() calls
+	uint64_t uring_sqes;		//!< SQEs submitted to io_uring
+	uint64_t uring_recvs;		//!< buffers filled by multishot recv on bridge sockets
+	uint64_t uring_sends;		//!< SENDMSG requests queued for bridge sockets
+	uint64_t uring_accepts;		//!< connections taken by multishot accept
+	uint64_t splices;			//!< splice() calls on bridge sockets
+	uint64_t pipes_created;		//!< pipes created, the rest came from the pipe pool
+	uint64_t bufs_allocated;	//!< queue buffers allocated, the rest came from the buffer pool
+	uint64_t zc_sends;			//!< MSG_ZEROCOPY sends
+	uint64_t zc_completed;		//!< MSG_ZEROCOPY sends completed
+	uint64_t zc_copied;			//!< of those the kernel copied anyway, plus ENOBUFS fallbacks
+	uint64_t sockmap_offloads;	//!< bridges handed to the kernel sockmap
+	uint64_t sockmap_fails;		//!< bridges the sockmap refused
+	uint64_t qsize[QSIZE_BUCKETS];	//!< queue sizes picked by autosizing (histogram)
+} __attribute__((aligned(64))) stats_t;
+
+extern __thread stats_t *stats_local;
+
+#define STATS_ADD(field, n) \
+	do { \
+		if (stats_local) \
+			__atomic_store_n(&stats_local->field, \
+			                 __atomic_load_n(&stats_local->field, __ATOMIC_RELAXED) + (n), \
+			                 __ATOMIC_RELAXED); \
+	} while(0)
+
+#define STATS_INC(field) STATS_ADD(field, 1)
+#define STATS_DEC(field) STATS_ADD(field, (uint64_t)-1)
+#define STATS_SUB(field, n) STATS_ADD(field, -(uint64_t)(n))
+
+int  stats_init(int workers);
+void stats_attach(int worker);
+void stats_dump(FILE *out);
+void stats_qsize(size_t size);
+
+#endif /* STATS_H_ */
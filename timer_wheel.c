@@ -0,0 +1,196 @@
+/*
+ * timer_wheel.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <string.h>
+
+#include "timer_wheel.h"
+#include "sp.h"
+#include "logger.h"
+
+/*
+ * Hierarchical timer wheel: TW_LEVELS levels of TW_SLOTS slots each,
+ * level N slot spans TW_SLOTS^N ticks. Arm and cancel are O(1), a timer
+ * moves down one level each time its slot on the upper level comes due.
+ */
+
+#define TW_MAX_DELTA ((1ULL << (TW_BITS * TW_LEVELS)) - 1)
+
+static void __timer_unlink(timer_wheel_t *this, tw_timer_t *timer)
+{
+	LIST_REMOVE(timer, list);
+
+	if (LIST_EMPTY(&this->slots[timer->level][timer->slot]))
+		this->occupied[timer->level] &= ~(1ULL << timer->slot);
+
+	timer->armed = 0;
+	timer->level = -1;
+	this->count--;
+}
+
+static void __timer_link(timer_wheel_t *this, tw_timer_t *timer)
+{
+	uint64_t delta = (timer->expires > this->current) ? timer->expires - this->current : 0;
+	int level = 0;
+
+	if (delta > TW_MAX_DELTA) {
+		delta = TW_MAX_DELTA;
+		timer->expires = this->current + delta;
+	}
+
+	while (level < TW_LEVELS - 1 && delta >= (1ULL << (TW_BITS * (level + 1))))
+		level++;
+
+	timer->level = level;
+	timer->slot  = (int)((timer->expires >> (TW_BITS * level)) & TW_MASK);
+	timer->armed = 1;
+
+	LIST_INSERT_HEAD(&this->slots[level][timer->slot], timer, list);
+	this->occupied[level] |= (1ULL << timer->slot);
+	this->count++;
+}
+
+timer_wheel_t *timer_wheel_create(uint64_t tick_ms, uint64_t now_ms)
+{
+	timer_wheel_t *rc = NULL;
+	int l = 0, s = 0;
+
+	do {
+		if (!tick_ms)
+			break;
+
+		rc = sp_t_calloc(sizeof(timer_wheel_t), NULL, "timer_wheel_t");
+		if (!rc)
+			break;
+
+		rc->tick_ms = tick_ms;
+		rc->current = now_ms / tick_ms;
+
+		for (l = 0; l < TW_LEVELS; l++)
+			for (s = 0; s < TW_SLOTS; s++)
+				LIST_INIT(&rc->slots[l][s]);
+
+		return rc;
+	} while(0);
+
+	if (rc)
+		sp_free(rc);
+
+	return NULL;
+}
+
+void timer_wheel_arm(timer_wheel_t *this, tw_timer_t *timer, uint64_t now_ms, uint64_t timeout_ms,
+                     tw_cb_fn cb, void *arg)
+{
+	if (!this || !timer)
+		return;
+
+	if (timer->armed)
+		__timer_unlink(this, timer);
+
+	timer->cb      = cb;
+	timer->arg     = arg;
+	timer->expires = (now_ms + timeout_ms + this->tick_ms - 1) / this->tick_ms;
+
+	/* the current slot has been processed already, due timers go into the next one */
+	if (timer->expires <= this->current)
+		timer->expires = this->current + 1;
+
+	__timer_link(this, timer);
+}
+
+void timer_wheel_cancel(timer_wheel_t *this, tw_timer_t *timer)
+{
+	if (!this || !timer || !timer->armed)
+		return;
+
+	__timer_unlink(this, timer);
+}
+
+/* move the timers of an upper level slot down to where they belong now */
+static void __timer_cascade(timer_wheel_t *this, int level)
+{
+	int slot = (int)((this->current >> (TW_BITS * level)) & TW_MASK);
+	struct tw_list *head = &this->slots[level][slot];
+
+	while (!LIST_EMPTY(head)) {
+		tw_timer_t *timer = LIST_FIRST(head);
+
+		__timer_unlink(this, timer);
+		__timer_link(this, timer);
+	}
+}
+
+void timer_wheel_advance(timer_wheel_t *this, uint64_t now_ms)
+{
+	uint64_t target = 0;
+
+	if (!this)
+		return;
+
+	target = now_ms / this->tick_ms;
+
+	while (this->current < target) {
+		struct tw_list *head = NULL;
+		int level = 0;
+
+		if (!this->count) {
+			this->current = target;
+			break;
+		}
+
+		this->current++;
+
+		for (level = 1; level < TW_LEVELS; level++) {
+			if (this->current & ((1ULL << (TW_BITS * level)) - 1))
+				break;
+			__timer_cascade(this, level);
+		}
+
+		head = &this->slots[0][this->current & TW_MASK];
+		while (!LIST_EMPTY(head)) {
+			tw_timer_t *timer = LIST_FIRST(head);
+
+			__timer_unlink(this, timer);
+
+			if (timer->cb)
+				timer->cb(timer, timer->arg);
+		}
+	}
+}
+
+int64_t timer_wheel_next(timer_wheel_t *this, uint64_t now_ms)
+{
+	uint64_t ticks = TW_SLOTS;
+	uint64_t bits  = 0;
+	int64_t  rc    = 0;
+	int offset = 0;
+	int level  = 0;
+
+	if (!this || !this->count)
+		return -1;
+
+	/* level 0 holds everything due within TW_SLOTS ticks */
+	offset = (int)((this->current + 1) & TW_MASK);
+	bits   = this->occupied[0];
+	bits   = (offset) ? ((bits >> offset) | (bits << (TW_SLOTS - offset))) : bits;
+	if (bits)
+		ticks = (uint64_t)__builtin_ctzll(bits) + 1;
+
+	/* upper levels only need a wakeup at the next cascade */
+	for (level = 1; level < TW_LEVELS; level++) {
+		if (this->occupied[level]) {
+			uint64_t cascade = TW_SLOTS - (this->current & TW_MASK);
+			if (cascade < ticks)
+				ticks = cascade;
+			break;
+		}
+	}
+
+	rc = (int64_t)((this->current + ticks) * this->tick_ms) - (int64_t)now_ms;
+
+	return (rc < 0) ? 0 : rc;
+}
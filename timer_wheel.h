@@ -0,0 +1,58 @@
+/*
+ * timer_wheel.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/queue.h>
+
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_MASK   (TW_SLOTS - 1)
+#define TW_LEVELS 4
+
+struct tw_timer_struct;
+typedef struct tw_timer_struct tw_timer_t;
+
+typedef void (*tw_cb_fn)(tw_timer_t *timer, void *arg);
+
+/*
+ * Timer entry, embedded into the object it belongs to.
+ * Zeroed memory is a valid disarmed timer.
+ */
+struct tw_timer_struct
+{
+	LIST_ENTRY(tw_timer_struct) list;
+	uint64_t  expires;	//!< expiration tick
+	tw_cb_fn  cb;
+	void     *arg;
+	int       level;	//!< -1 when not armed
+	int       slot;
+	int       armed;
+};
+
+LIST_HEAD(tw_list, tw_timer_struct);
+
+typedef struct timer_wheel_type
+{
+	uint64_t tick_ms;					//!< wheel resolution
+	uint64_t current;					//!< current tick
+	size_t   count;						//!< armed timers
+	uint64_t occupied[TW_LEVELS];		//!< non-empty slots bitmap per level
+	struct tw_list slots[TW_LEVELS][TW_SLOTS];
+} timer_wheel_t;
+
+timer_wheel_t *timer_wheel_create(uint64_t tick_ms, uint64_t now_ms);
+void timer_wheel_arm(timer_wheel_t *this, tw_timer_t *timer, uint64_t now_ms, uint64_t timeout_ms,
+                     tw_cb_fn cb, void *arg);
+void timer_wheel_cancel(timer_wheel_t *this, tw_timer_t *timer);
+void timer_wheel_advance(timer_wheel_t *this, uint64_t now_ms);
+int64_t timer_wheel_next(timer_wheel_t *this, uint64_t now_ms);
+
+#endif /* TIMER_WHEEL_H_ */
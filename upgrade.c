@@ -0,0 +1,505 @@
+/*
+ * upgrade.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "upgrade.h"
+#include "config.h"
+#include "lock.h"
+#include "logger.h"
+#include "sp.h"
+
+#define UPGRADE_MAX_FDS 2	//!< fds of one record: cli and srv of a bridge
+
+/* old process: the new binary we hand over to, records of one bridge go under the lock */
+static int    conn = -1;
+static mtx_t *lock = NULL;
+
+/* new process: what the old one handed over, until the workers take it */
+static struct
+{
+	unsigned short port;
+	int fd;					//!< -1 - taken
+} listeners[MAX_THREADS * MAX_LISTENERS];
+static int nlisteners = 0;
+
+static upgrade_import_t **imports = NULL;	//!< one list per worker
+static int nworkers = 0;
+
+static int __address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		LOGGER_ERR("upgrade socket path {%s} is too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr->sun_path, path);
+
+	return 0;
+}
+
+static int __send(int fd, upgrade_record_t type, const void *buf, size_t len, const int *fds, int nfds)
+{
+	upgrade_header_t hdr = { UPGRADE_MAGIC, UPGRADE_VERSION, (uint16_t)type };
+	char   cmsg_buf[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+	struct iovec   iov[2];
+	struct msghdr  msg;
+	struct cmsghdr *cmsg = NULL;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len  = sizeof(hdr);
+	iov[1].iov_base = (void*)buf;
+	iov[1].iov_len  = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = (len) ? 2 : 1;
+
+	if (nfds) {
+		memset(cmsg_buf, 0, sizeof(cmsg_buf));
+		msg.msg_control    = cmsg_buf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+		LOGGER_ERR("upgrade record {%d} was not sent: %s\n", type, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* payload length or -1, the fds received are in fds, *nfds of them */
+static ssize_t __recv(int fd, upgrade_record_t *type, void *buf, size_t size, int *fds, int *nfds)
+{
+	upgrade_header_t hdr;
+	char   cmsg_buf[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+	struct iovec   iov[2];
+	struct msghdr  msg;
+	struct cmsghdr *cmsg = NULL;
+	ssize_t n = 0;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len  = sizeof(hdr);
+	iov[1].iov_base = buf;
+	iov[1].iov_len  = size;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov        = iov;
+	msg.msg_iovlen     = 2;
+	msg.msg_control    = cmsg_buf;
+	msg.msg_controllen = sizeof(cmsg_buf);
+
+	*nfds = 0;
+
+	n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	if (n <= 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+			continue;
+
+		*nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+	}
+
+	if ((size_t)n < sizeof(hdr) || UPGRADE_MAGIC != hdr.magic || UPGRADE_VERSION != hdr.version ||
+	    msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		LOGGER_ERR("malformed upgrade record, version {%u}\n", hdr.version);
+		while (*nfds)
+			close(fds[--(*nfds)]);
+		return -1;
+	}
+
+	*type = (upgrade_record_t)hdr.type;
+
+	return n - (ssize_t)sizeof(hdr);
+}
+
+/* every listener and live client goes over the socket: only a process of our own user is talked to */
+static int __peer_trusted(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return 0;
+
+	if (cred.uid != geteuid()) {
+		LOGGER_ERR("upgrade peer pid {%d} uid {%d} is not uid {%d}, refused\n", (int)cred.pid, (int)cred.uid, (int)geteuid());
+		return 0;
+	}
+
+	return 1;
+}
+
+int upgrade_serve(const char *path)
+{
+	struct sockaddr_un addr;
+	mode_t mask = 0;
+	int rc = -1;
+	int fd = -1;
+
+	do {
+		if (__address(path, &addr) < 0)
+			break;
+
+		fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			break;
+
+		/* a path left by a process that is gone, or the one we took over from */
+		unlink(path);
+
+		/* created 0600 right away, chmod() after bind() would leave a window */
+		mask = umask(0177);
+		rc   = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+		umask(mask);
+		if (rc < 0)
+			break;
+
+		if (listen(fd, 1) < 0)
+			break;
+
+		return fd;
+	} while(0);
+
+	LOGGER_ERR("failed to serve upgrades on {%s}: %s\n", path, strerror(errno));
+
+	if (fd >= 0)
+		close(fd);
+
+	return -1;
+}
+
+int upgrade_begin(int fd)
+{
+	int in_fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+	if (in_fd < 0)
+		return -1;
+
+	if (!__peer_trusted(in_fd)) {
+		close(in_fd);
+		return -1;
+	}
+
+	lock = mutex_allocate();
+	if (!lock) {
+		close(in_fd);
+		return -1;
+	}
+
+	__atomic_store_n(&conn, in_fd, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int upgrade_active(void)
+{
+	return __atomic_load_n(&conn, __ATOMIC_ACQUIRE) >= 0;
+}
+
+int upgrade_send_listener(unsigned short port, int fd)
+{
+	upgrade_listener_t rec = { port };
+
+	return __send(conn, UPGRADE_LISTENER, &rec, sizeof(rec), &fd, 1);
+}
+
+int upgrade_send_bridge(const upgrade_bridge_t *rec, int cli_fd, int srv_fd, const char *data)
+{
+	int    fds[UPGRADE_MAX_FDS] = { cli_fd, srv_fd };
+	size_t len = (size_t)rec->cli_pending + rec->srv_pending;
+	size_t off = 0;
+	int rc = -1;
+
+	mutex_lock(lock);
+
+	do {
+		if (__send(conn, UPGRADE_BRIDGE, rec, sizeof(*rec), fds, (srv_fd >= 0) ? 2 : 1) < 0)
+			break;
+
+		for (off = 0; off < len; off += UPGRADE_CHUNK)
+			if (__send(conn, UPGRADE_DATA, data + off, (len - off > UPGRADE_CHUNK) ? UPGRADE_CHUNK : len - off, NULL, 0) < 0)
+				break;
+
+		if (off < len)
+			break;
+
+		rc = 0;
+	} while(0);
+
+	mutex_unlock(lock);
+
+	return rc;
+}
+
+void upgrade_end(void)
+{
+	if (conn < 0)
+		return;
+
+	__send(conn, UPGRADE_END, NULL, 0, NULL, 0);
+	close(conn);
+	conn = -1;
+
+	if (lock) {
+		mutex_destroy(lock);
+		sp_free(lock);
+	}
+	lock = NULL;
+}
+
+static void __import_add(upgrade_import_t *imp, int *n)
+{
+	int worker = (*n)++ % nworkers;
+
+	imp->next = imports[worker];
+	imports[worker] = imp;
+}
+
+static upgrade_import_t *__import_new(const void *buf, ssize_t len, const int *fds, int nfds)
+{
+	upgrade_import_t *imp = NULL;
+
+	if (len != sizeof(upgrade_bridge_t) || nfds < 1)
+		return NULL;
+
+	imp = sp_calloc(sizeof(upgrade_import_t));
+	if (!imp)
+		return NULL;
+
+	memcpy(&imp->rec, buf, sizeof(imp->rec));
+	imp->cli_fd = fds[0];
+	imp->srv_fd = (nfds > 1) ? fds[1] : -1;
+
+	if (imp->rec.cli_pending || imp->rec.srv_pending) {
+		imp->data = sp_malloc((size_t)imp->rec.cli_pending + imp->rec.srv_pending);
+		if (!imp->data) {
+			imp->cli_fd = imp->srv_fd = -1;
+			upgrade_import_free(imp);
+			return NULL;
+		}
+	}
+
+	return imp;
+}
+
+int upgrade_take(const char *path, int workers)
+{
+	static char buf[UPGRADE_CHUNK];
+	struct sockaddr_un addr;
+	upgrade_import_t *imp = NULL;
+	upgrade_record_t type = 0;
+	int fds[UPGRADE_MAX_FDS];
+	int nfds = 0;
+	int nbridges = 0;
+	int done = 0;
+	int fd = -1;
+	ssize_t n = 0;
+
+	if (__address(path, &addr) < 0)
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		int err = errno;
+
+		close(fd);
+
+		/* no path or nobody behind it: a fresh start */
+		if (ENOENT == err || ECONNREFUSED == err)
+			return 0;
+
+		LOGGER_ERR("failed to connect to {%s}: %s\n", path, strerror(err));
+		return -1;
+	}
+
+	if (!__peer_trusted(fd)) {
+		close(fd);
+		return -1;
+	}
+
+	imports = sp_calloc(workers * sizeof(upgrade_import_t*));
+	if (!imports) {
+		close(fd);
+		return -1;
+	}
+
+	nworkers = workers;
+
+	/* a record that does not fit ends the upgrade, whatever came before it is kept */
+	while (!done && (n = __recv(fd, &type, buf, sizeof(buf), fds, &nfds)) >= 0) {
+		switch (type) {
+			case UPGRADE_LISTENER:
+				if (1 != nfds || n != sizeof(upgrade_listener_t) || nlisteners >= MAX_THREADS * MAX_LISTENERS) {
+					done = -1;
+					break;
+				}
+
+				listeners[nlisteners].port = ((upgrade_listener_t*)buf)->port;
+				listeners[nlisteners].fd   = fds[0];
+				nlisteners++;
+				nfds = 0;
+				break;
+			case UPGRADE_BRIDGE:
+				if (imp) {
+					done = -1;
+					break;
+				}
+
+				imp = __import_new(buf, n, fds, nfds);
+				if (!imp) {
+					done = -1;
+					break;
+				}
+
+				nfds = 0;
+				if (!imp->data) {
+					__import_add(imp, &nbridges);
+					imp = NULL;
+				}
+				break;
+			case UPGRADE_DATA:
+				if (nfds || !imp || imp->len + n > (size_t)imp->rec.cli_pending + imp->rec.srv_pending) {
+					done = -1;
+					break;
+				}
+
+				memcpy(imp->data + imp->len, buf, n);
+				imp->len += n;
+
+				if (imp->len == (size_t)imp->rec.cli_pending + imp->rec.srv_pending) {
+					__import_add(imp, &nbridges);
+					imp = NULL;
+				}
+				break;
+			case UPGRADE_END:
+				done = 1;
+				break;
+			default:
+				done = -1;
+				break;
+		}
+	}
+
+	while (nfds)
+		close(fds[--nfds]);
+
+	if (imp)
+		upgrade_import_free(imp);
+
+	close(fd);
+
+	if (done <= 0)
+		LOGGER_ERR("upgrade from {%s} was cut short, %d listeners and %d bridges taken over\n", path, nlisteners, nbridges);
+
+	return 1;
+}
+
+int upgrade_listener(unsigned short port)
+{
+	int fd = -1;
+	int i = 0;
+
+	for (i = 0; i < nlisteners; i++) {
+		if (port != listeners[i].port || listeners[i].fd < 0)
+			continue;
+
+		fd = listeners[i].fd;
+		listeners[i].fd = -1;
+		break;
+	}
+
+	return fd;
+}
+
+upgrade_import_t *upgrade_imports(int worker)
+{
+	upgrade_import_t *list = NULL;
+
+	if (!imports || worker >= nworkers)
+		return NULL;
+
+	list = imports[worker];
+	imports[worker] = NULL;
+
+	return list;
+}
+
+void upgrade_import_free(upgrade_import_t *imp)
+{
+	if (imp->cli_fd >= 0)
+		close(imp->cli_fd);
+
+	if (imp->srv_fd >= 0)
+		close(imp->srv_fd);
+
+	if (imp->data)
+		sp_free(imp->data);
+
+	sp_free(imp);
+}
+
+void upgrade_close_listeners(void)
+{
+	int i = 0;
+
+	/* the port is not ours any more or this process runs fewer workers: their accept queues go too */
+	for (i = 0; i < nlisteners; i++) {
+		if (listeners[i].fd < 0)
+			continue;
+
+		LOGGER_ERR("listener on port {%d} handed over is not used, closing it\n", listeners[i].port);
+		close(listeners[i].fd);
+		listeners[i].fd = -1;
+	}
+}
+
+void upgrade_release(void)
+{
+	upgrade_import_t *imp = NULL;
+	int i = 0;
+
+	upgrade_close_listeners();
+
+	for (i = 0; imports && i < nworkers; i++) {
+		while ((imp = imports[i])) {
+			imports[i] = imp->next;
+			upgrade_import_free(imp);
+		}
+	}
+
+	if (imports)
+		sp_free(imports);
+
+	imports  = NULL;
+	nworkers = 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * upgrade.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef UPGRADE_H_
+#define UPGRADE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define UPGRADE_MAGIC   0x74707570	//!< "tpup"
+#define UPGRADE_VERSION 1
+#define UPGRADE_CHUNK   (32*1024)	//!< queued bytes per data record
+
+/*
+ * Hot upgrade over a Unix SOCK_SEQPACKET socket at --upgrade <path>.
+ * A running process serves the path. A new binary started with the
+ * same path connects to it and takes over: first the listener fds, the
+ * old process stops its workers then, each of them hands its bridges
+ * over and closes its copies quietly. The new binary resumes them as
+ * they were and serves the path itself, the old one exits. The path is
+ * created 0600 and both ends check with SO_PEERCRED that the other runs
+ * as the same user.
+ *
+ * Records are one packet each, a header and a payload. The fds ride
+ * along with SCM_RIGHTS, the queued bytes of a bridge follow it in data
+ * records, toward cli first. Both sides run on one host: the payload is
+ * in host byte order, monotonic timestamps stay valid.
+ */
+typedef enum upgrade_record_type
+{
+	UPGRADE_LISTENER = 1,	//!< one listener fd, upgrade_listener_t
+	UPGRADE_BRIDGE,			//!< cli fd and srv fd if any, upgrade_bridge_t
+	UPGRADE_DATA,			//!< queued bytes of the last bridge
+	UPGRADE_END				//!< the old process has handed over everything
+} upgrade_record_t;
+
+typedef struct upgrade_header_type
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;		//!< upgrade_record_t
+} upgrade_header_t;
+
+typedef struct upgrade_listener_type
+{
+	uint16_t port;
+} upgrade_listener_t;
+
+typedef struct upgrade_bridge_type
+{
+	int32_t  state;			//!< bridge_state_t
+	int32_t  fastopen;
+	uint16_t listen_port;	//!< picks the tuning profile again
+	uint8_t  cli_eof;
+	uint8_t  cli_shut;
+	uint8_t  srv_eof;
+	uint8_t  srv_shut;
+	uint8_t  pad[2];
+	int64_t  created;		//!< time(NULL) stamps of the states
+	int64_t  connected;
+	int64_t  stopping;
+	uint64_t connect_start;	//!< io_loop_now() stamps, CLOCK_MONOTONIC is host wide
+	uint64_t last_io;
+	uint32_t cli_pending;	//!< queued bytes toward cli
+	uint32_t srv_pending;	//!< queued bytes toward srv
+} upgrade_bridge_t;
+
+/* a bridge the new process took over, adopted by one of its workers */
+typedef struct upgrade_import_type
+{
+	upgrade_bridge_t rec;
+	int   cli_fd;
+	int   srv_fd;			//!< -1 - no upstream yet
+	char *data;				//!< cli_pending bytes toward cli, then srv_pending toward srv
+	size_t len;				//!< bytes received so far
+	struct upgrade_import_type *next;
+} upgrade_import_t;
+
+/*
+ * Old process side. upgrade_serve() binds the path, upgrade_begin()
+ * accepts a new binary on it. The rest is called from any thread, a
+ * bridge goes in one piece.
+ */
+int  upgrade_serve(const char *path);
+int  upgrade_begin(int fd);
+int  upgrade_active(void);
+int  upgrade_send_listener(unsigned short port, int fd);
+int  upgrade_send_bridge(const upgrade_bridge_t *rec, int cli_fd, int srv_fd, const char *data);
+void upgrade_end(void);
+
+/*
+ * New process side, before the workers start. upgrade_take() returns 1
+ * once it took over, 0 if no process serves the path and -1 on failure.
+ * Bridges are spread over the workers, listeners are taken by port.
+ * upgrade_close_listeners() closes the listeners nobody took, right
+ * away: nobody would accept from them. upgrade_release() frees the rest.
+ */
+int  upgrade_take(const char *path, int workers);
+int  upgrade_listener(unsigned short port);
+upgrade_import_t *upgrade_imports(int worker);
+void upgrade_import_free(upgrade_import_t *imp);
+void upgrade_close_listeners(void);
+void upgrade_release(void);
+
+#endif /* UPGRADE_H_ */
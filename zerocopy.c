@@ -0,0 +1,258 @@
+/*
+ * zerocopy.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "zerocopy.h"
+#include "io_loop.h"
+#include "logger.h"
+#include "stats.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+/*
+ * Buffers of closed sockets may still be referenced by skbs on their way
+ * out, no completion will tell when. They are freed after sitting in
+ * 'young' and then 'old' for ZC_ORPHAN_TIMEOUT each.
+ */
+static __thread struct queue orphans_young;
+static __thread struct queue orphans_old;
+static __thread int          orphans_init = 0;
+static __thread tw_timer_t   orphans_timer;
+
+static void __orphans_free(struct queue *head)
+{
+	send_queue_node_t *node = NULL;
+
+	while ((node = TAILQ_FIRST(head))) {
+		TAILQ_REMOVE(head, node, list);
+		queue_node_release(node);
+	}
+}
+
+static void __orphans_reap(tw_timer_t *timer, void *arg)
+{
+	send_queue_node_t *node = NULL;
+
+	__orphans_free(&orphans_old);
+
+	while ((node = TAILQ_FIRST(&orphans_young))) {
+		TAILQ_REMOVE(&orphans_young, node, list);
+		TAILQ_INSERT_TAIL(&orphans_old, node, list);
+	}
+
+	if (!TAILQ_EMPTY(&orphans_old))
+		io_timer_arm(timer, ZC_ORPHAN_TIMEOUT * 1000, __orphans_reap, NULL);
+}
+
+static void __orphan(send_queue_node_t *node)
+{
+	if (!orphans_init) {
+		TAILQ_INIT(&orphans_young);
+		TAILQ_INIT(&orphans_old);
+		orphans_init = 1;
+	}
+
+	TAILQ_INSERT_TAIL(&orphans_young, node, list);
+
+	if (!orphans_timer.armed)
+		io_timer_arm(&orphans_timer, ZC_ORPHAN_TIMEOUT * 1000, __orphans_reap, NULL);
+}
+
+/* send ids wrap around */
+static int __id_before(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+/* how many of the node's sends fall into the completed range [lo, hi] */
+static uint32_t __completed(send_queue_node_t *node, uint32_t lo, uint32_t hi)
+{
+	uint32_t from = node->zc_lo;
+	uint32_t to   = node->zc_lo + node->zc_refs - 1;
+
+	if (!node->zc_refs)
+		return 0;
+
+	if (__id_before(from, lo))
+		from = lo;
+
+	if (__id_before(hi, to))
+		to = hi;
+
+	if (__id_before(to, from))
+		return 0;
+
+	return to - from + 1;
+}
+
+int zc_enable(zc_t *this, int fd)
+{
+	int enable = 1;
+
+	TAILQ_INIT(&this->inflight);
+	this->next_id = 0;
+	this->enabled = 0;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0) {
+		LOGGER_DBG( "SO_ZEROCOPY is not supported on fd {%d}\n", fd);
+		return -1;
+	}
+
+	this->enabled = 1;
+
+	return 0;
+}
+
+ssize_t zc_send(zc_t *this, int fd, send_queue_t *queue)
+{
+	send_queue_node_t *node = queue_get_first(queue);
+	ssize_t n = 0;
+
+	if (!node)
+		return 0;
+
+	n = send(fd, node->buf + node->drained, node->len - node->drained, MSG_NOSIGNAL | MSG_ZEROCOPY);
+	if (n < 0 && ENOBUFS == errno) {
+		/* out of optmem for pinned pages, copy this chunk */
+		STATS_INC(zc_copied);
+		n = send(fd, node->buf + node->drained, node->len - node->drained, MSG_NOSIGNAL);
+	} else if (n >= 0) {
+		/* the kernel numbers every successful MSG_ZEROCOPY call */
+		STATS_INC(zc_sends);
+		if (!node->zc_refs)
+			node->zc_lo = this->next_id;
+		node->zc_refs++;
+		this->next_id++;
+	}
+
+	if (n <= 0)
+		return n;
+
+	node->drained += n;
+	if (node->drained < node->len)
+		return n;
+
+	node = queue_detach_first(queue);
+	if (node->zc_refs)
+		TAILQ_INSERT_TAIL(&this->inflight, node, list);
+	else
+		queue_node_release(node);
+
+	return n;
+}
+
+static void __zc_completed(zc_t *this, send_queue_t *queue, uint32_t lo, uint32_t hi)
+{
+	send_queue_node_t *node = NULL;
+	send_queue_node_t *next = NULL;
+
+	/* the head of the queue may be partially sent */
+	node = queue_get_first(queue);
+	if (node)
+		node->zc_refs -= __completed(node, lo, hi);
+
+	for (node = TAILQ_FIRST(&this->inflight); node; node = next) {
+		next = TAILQ_NEXT(node, list);
+
+		node->zc_refs -= __completed(node, lo, hi);
+		if (node->zc_refs)
+			continue;
+
+		TAILQ_REMOVE(&this->inflight, node, list);
+		queue_node_release(node);
+	}
+}
+
+int zc_complete(zc_t *this, int fd, send_queue_t *queue)
+{
+	int cnt = 0;
+
+	if (!this->enabled)
+		return 0;
+
+	while (1) {
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+		struct msghdr   msg;
+		struct cmsghdr *cm = NULL;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (EAGAIN == errno)
+				break;
+			if (EINTR == errno)
+				continue;
+
+			LOGGER_DBG( "recvmsg MSG_ERRQUEUE error on fd {%d}\n", fd);
+			return -1;
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *serr = NULL;
+
+			if (SOL_IP != cm->cmsg_level || IP_RECVERR != cm->cmsg_type)
+				continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (SO_EE_ORIGIN_ZEROCOPY != serr->ee_origin || serr->ee_errno)
+				continue;
+
+			/* the range is [ee_info, ee_data], coalesced by the kernel */
+			STATS_ADD(zc_completed, serr->ee_data - serr->ee_info + 1);
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				STATS_ADD(zc_copied, serr->ee_data - serr->ee_info + 1);
+
+			__zc_completed(this, queue, serr->ee_info, serr->ee_data);
+			cnt++;
+		}
+	}
+
+	return cnt;
+}
+
+void zc_release(zc_t *this, send_queue_t *queue)
+{
+	send_queue_node_t *node = NULL;
+
+	if (!this->enabled)
+		return;
+
+	node = queue_get_first(queue);
+	if (node && node->zc_refs)
+		__orphan(queue_detach_first(queue));
+
+	while ((node = TAILQ_FIRST(&this->inflight))) {
+		TAILQ_REMOVE(&this->inflight, node, list);
+		__orphan(node);
+	}
+
+	this->enabled = 0;
+}
+
+void zc_cleanup(void)
+{
+	if (!orphans_init)
+		return;
+
+	io_timer_cancel(&orphans_timer);
+	__orphans_free(&orphans_young);
+	__orphans_free(&orphans_old);
+}
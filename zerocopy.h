@@ -0,0 +1,44 @@
+/*
+ * zerocopy.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: vitaliy
+ */
+
+#ifndef ZEROCOPY_H_
+#define ZEROCOPY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "send_queue.h"
+
+#define ZC_ORPHAN_TIMEOUT 60	//!< seconds to keep buffers of a closed socket with sends in flight
+
+/*
+ * MSG_ZEROCOPY state of one socket. A node sent with MSG_ZEROCOPY keeps
+ * its pages pinned by the kernel, so once drained it waits on the
+ * inflight list until the error queue reports all its sends completed.
+ */
+typedef struct zerocopy_type
+{
+	int enabled;			//!< SO_ZEROCOPY is set on the socket
+	uint32_t next_id;		//!< notification id of the next MSG_ZEROCOPY send
+	struct queue inflight;	//!< drained nodes with sends not completed yet
+} zc_t;
+
+int  zc_enable(zc_t *this, int fd);
+
+/* send the first node of queue with MSG_ZEROCOPY, same result as send() */
+ssize_t zc_send(zc_t *this, int fd, send_queue_t *queue);
+
+/* read completions from the error queue, returns how many were read or -1 */
+int  zc_complete(zc_t *this, int fd, send_queue_t *queue);
+
+/* socket is going away: park buffers still in flight for ZC_ORPHAN_TIMEOUT */
+void zc_release(zc_t *this, send_queue_t *queue);
+
+/* worker is going away: free parked buffers */
+void zc_cleanup(void);
+
+#endif /* ZEROCOPY_H_ */